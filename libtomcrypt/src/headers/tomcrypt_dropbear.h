@@ -38,6 +38,10 @@
 #define LTC_POLY1305
 #endif
 
+#if DROPBEAR_FAST_RANDOM
+#define LTC_CHACHA
+#endif
+
 #if DROPBEAR_SHA512
 #define LTC_SHA512
 #endif
@@ -50,6 +50,108 @@ buffer* buf_new(unsigned int size) {
 	return buf;
 }
 
+/* As for buf_new() but the contents aren't zeroed. Only bytes that
+ * have been written are ever read since buf_getptr() etc are limited
+ * to buf->len, but callers must be careful that buf_incrlen() and
+ * buf_setlen() only cover written data. */
+buffer* buf_new_nozero(unsigned int size) {
+	buffer* buf;
+	if (size > BUF_MAX_SIZE) {
+		dropbear_exit("buf->size too big");
+	}
+
+	buf = (buffer*)m_malloc_nozero(sizeof(buffer)+size);
+	buf->data = (unsigned char*)buf + sizeof(buffer);
+	buf->size = size;
+	buf->len = 0;
+	buf->pos = 0;
+	return buf;
+}
+
+/* Sizes of buffers kept by a buf_pool. The larger two fit outgoing
+ * packets of TRANS_MAX_PAYLOAD_LEN with room for padding, MAC and
+ * compression overhead, and incoming packets. */
+static const unsigned int buf_pool_sizes[BUF_POOL_CLASSES] = {
+	256,
+	2048,
+	TRANS_MAX_PAYLOAD_LEN + 256,
+	RECV_MAX_PACKET_LEN,
+};
+
+/* Returns the smallest pool class that holds size, or -1 */
+static int buf_pool_class(unsigned int size) {
+	int i, class = -1;
+	for (i = 0; i < BUF_POOL_CLASSES; i++) {
+		if (buf_pool_sizes[i] >= size
+			&& (class < 0 || buf_pool_sizes[i] < buf_pool_sizes[class])) {
+			class = i;
+		}
+	}
+	return class;
+}
+
+/* Returns an empty buffer of at least size bytes, reusing one from
+ * the pool if available. The contents aren't zeroed, the same as
+ * buf_new_nozero(). */
+buffer* buf_pool_get(struct buf_pool *pool, unsigned int size) {
+	buffer* buf;
+	int class;
+
+	class = buf_pool_class(size);
+	if (class < 0) {
+		pool->allocated++;
+		return buf_new_nozero(size);
+	}
+
+	if (pool->count[class] > 0) {
+		pool->count[class]--;
+		buf = pool->bufs[class][pool->count[class]];
+		pool->bufs[class][pool->count[class]] = NULL;
+		pool->reused++;
+	} else {
+		buf = buf_new_nozero(buf_pool_sizes[class]);
+		pool->allocated++;
+	}
+	buf->len = 0;
+	buf->pos = 0;
+	return buf;
+}
+
+/* Gives buf back to the pool, or frees it if the pool has enough
+ * of that size. burn should be set if buf held decrypted data. */
+void buf_pool_put(struct buf_pool *pool, buffer *buf, int burn) {
+	int i, class = -1;
+
+	if (burn) {
+		m_burn(buf->data, buf->len);
+	}
+
+	for (i = 0; i < BUF_POOL_CLASSES; i++) {
+		if (buf->size == buf_pool_sizes[i]) {
+			class = i;
+			break;
+		}
+	}
+
+	if (class < 0 || pool->count[class] == BUF_POOL_DEPTH) {
+		buf_free(buf);
+		return;
+	}
+	pool->bufs[class][pool->count[class]] = buf;
+	pool->count[class]++;
+}
+
+void buf_pool_cleanup(struct buf_pool *pool) {
+	unsigned int i, j;
+	for (i = 0; i < BUF_POOL_CLASSES; i++) {
+		for (j = 0; j < pool->count[i]; j++) {
+			buf_free(pool->bufs[i][j]);
+			pool->bufs[i][j] = NULL;
+		}
+		pool->count[i] = 0;
+	}
+}
+
 /* free the buffer's data and the buffer itself */
 void buf_free(buffer* buf) {
 	m_free(buf);
@@ -83,7 +185,7 @@ buffer* buf_newcopy(const buffer* buf) {
 	
 	buffer* ret;
 
-	ret = buf_new(buf->len);
+	ret = buf_new_nozero(buf->len);
 	ret->len = buf->len;
 	if (buf->len > 0) {
 		memcpy(ret->data, buf->data, buf->len);
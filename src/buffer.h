@@ -40,7 +40,23 @@ struct buf {
 
 typedef struct buf buffer;
 
+#define BUF_POOL_CLASSES 4
+#define BUF_POOL_DEPTH 4
+
+/* Freelists of buffers by size, for packet buffers that would otherwise be
+ * allocated and freed for every packet. See buf_pool_get() */
+struct buf_pool {
+	buffer *bufs[BUF_POOL_CLASSES][BUF_POOL_DEPTH];
+	unsigned int count[BUF_POOL_CLASSES];
+	unsigned long reused; /* allocations avoided */
+	unsigned long allocated; /* buffers that weren't in the pool */
+};
+
 buffer * buf_new(unsigned int size);
+buffer * buf_new_nozero(unsigned int size);
+buffer * buf_pool_get(struct buf_pool *pool, unsigned int size);
+void buf_pool_put(struct buf_pool *pool, buffer *buf, int burn);
+void buf_pool_cleanup(struct buf_pool *pool);
 /* Possibly returns a new buffer*, like realloc() */
 buffer * buf_resize(buffer *buf, unsigned int newsize);
 void buf_free(buffer* buf);
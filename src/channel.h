@@ -107,8 +107,8 @@ void channel_connect_done(int result, int sock, void* user_data, const char* err
 
 void chaninitialise(const struct ChanType *chantypes[]);
 void chancleanup(void);
-void setchannelfds(fd_set *readfds, fd_set *writefds, int allow_reads);
-void channelio(const fd_set *readfd, const fd_set *writefd);
+void setchannelfds(int allow_reads);
+void channelio(void);
 struct Channel* getchannel(void);
 /* Returns an arbitrary channel that is in a ready state - not
 being initialised and no EOF in either direction. NULL if none. */
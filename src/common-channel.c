@@ -46,6 +46,7 @@ static int writechannel(struct Channel* channel, int fd, circbuffer *cbuf,
 static void send_msg_channel_window_adjust(const struct Channel *channel,
 		unsigned int incr);
 static void send_msg_channel_data(struct Channel *channel, int isextended);
+static void send_msg_channel_data_abort(buffer *writebuf);
 static void send_msg_channel_eof(struct Channel *channel);
 static void send_msg_channel_close(struct Channel *channel);
 static void remove_channel(struct Channel *channel);
@@ -196,7 +197,7 @@ struct Channel* getchannel() {
 }
 
 /* Iterate through the channels, performing IO if available */
-void channelio(const fd_set *readfds, const fd_set *writefds) {
+void channelio() {
 
 	/* Listeners such as TCP, X11, agent-auth */
 	struct Channel *channel;
@@ -214,7 +215,7 @@ void channelio(const fd_set *readfds, const fd_set *writefds) {
 		}
 
 		/* read data and send it over the wire */
-		if (channel->readfd >= 0 && FD_ISSET(channel->readfd, readfds)) {
+		if (dbpoll_isset(channel->readfd, DBPOLL_READ)) {
 			TRACE(("send normal readfd"))
 			send_msg_channel_data(channel, 0);
 			do_check_close = 1;
@@ -222,21 +223,21 @@ void channelio(const fd_set *readfds, const fd_set *writefds) {
 
 		/* read stderr data and send it over the wire */
 		if (ERRFD_IS_READ(channel) && channel->errfd >= 0 
-			&& FD_ISSET(channel->errfd, readfds)) {
+			&& dbpoll_isset(channel->errfd, DBPOLL_READ)) {
 				TRACE(("send normal errfd"))
 				send_msg_channel_data(channel, 1);
 			do_check_close = 1;
 		}
 
 		/* write to program/pipe stdin */
-		if (channel->writefd >= 0 && FD_ISSET(channel->writefd, writefds)) {
+		if (dbpoll_isset(channel->writefd, DBPOLL_WRITE)) {
 			writechannel(channel, channel->writefd, channel->writebuf, NULL, NULL);
 			do_check_close = 1;
 		}
 		
 		/* stderr for client mode */
 		if (ERRFD_IS_WRITE(channel)
-				&& channel->errfd >= 0 && FD_ISSET(channel->errfd, writefds)) {
+				&& channel->errfd >= 0 && dbpoll_isset(channel->errfd, DBPOLL_WRITE)) {
 			writechannel(channel, channel->errfd, channel->extrabuf, NULL, NULL);
 			do_check_close = 1;
 		}
@@ -253,7 +254,7 @@ void channelio(const fd_set *readfds, const fd_set *writefds) {
 	}
 
 #if DROPBEAR_LISTENERS
-	handle_listeners(readfds);
+	handle_listeners();
 #endif
 }
 
@@ -537,9 +538,9 @@ static int writechannel(struct Channel* channel, int fd, circbuffer *cbuf,
 }
 
 
-/* Set the file descriptors for the main select in session.c
+/* Register interest in file descriptors for the main loop in session.c
  * This avoid channels which don't have any window available, are closed, etc*/
-void setchannelfds(fd_set *readfds, fd_set *writefds, int allow_reads) {
+void setchannelfds(int allow_reads) {
 	
 	unsigned int i;
 	struct Channel * channel;
@@ -559,29 +560,38 @@ void setchannelfds(fd_set *readfds, fd_set *writefds, int allow_reads) {
 		if (channel->transwindow > 0
 		   && ((ses.dataallowed && allow_reads) || channel->read_mangler)) {
 
-			if (channel->readfd >= 0) {
-				FD_SET(channel->readfd, readfds);
-			}
+			dbpoll_set(channel->readfd, DBPOLL_READ);
 			
-			if (ERRFD_IS_READ(channel) && channel->errfd >= 0) {
-					FD_SET(channel->errfd, readfds);
+			if (ERRFD_IS_READ(channel)) {
+				dbpoll_set(channel->errfd, DBPOLL_READ);
+			}
+		} else {
+			dbpoll_unset(channel->readfd, DBPOLL_READ);
+
+			if (ERRFD_IS_READ(channel)) {
+				dbpoll_unset(channel->errfd, DBPOLL_READ);
 			}
 		}
 
 		/* Stuff from the wire */
-		if (channel->writefd >= 0 && cbuf_getused(channel->writebuf) > 0) {
-				FD_SET(channel->writefd, writefds);
+		if (cbuf_getused(channel->writebuf) > 0) {
+			dbpoll_set(channel->writefd, DBPOLL_WRITE);
+		} else {
+			dbpoll_unset(channel->writefd, DBPOLL_WRITE);
 		}
 
-		if (ERRFD_IS_WRITE(channel) && channel->errfd >= 0 
-				&& cbuf_getused(channel->extrabuf) > 0) {
-				FD_SET(channel->errfd, writefds);
+		if (ERRFD_IS_WRITE(channel)) {
+			if (cbuf_getused(channel->extrabuf) > 0) {
+				dbpoll_set(channel->errfd, DBPOLL_WRITE);
+			} else {
+				dbpoll_unset(channel->errfd, DBPOLL_WRITE);
+			}
 		}
 
 	} /* foreach channel */
 
 #if DROPBEAR_LISTENERS
-	set_listener_fds(readfds);
+	set_listener_fds();
 #endif
 
 }
@@ -635,6 +645,10 @@ static void remove_channel(struct Channel * channel) {
 		channel->extrabuf = NULL;
 	}
 
+	/* The client's stdio is left open, it mustn't stay in the poller */
+	dbpoll_unset(channel->writefd, DBPOLL_READ|DBPOLL_WRITE);
+	dbpoll_unset(channel->readfd, DBPOLL_READ|DBPOLL_WRITE);
+	dbpoll_unset(channel->errfd, DBPOLL_READ|DBPOLL_WRITE);
 
 	if (IS_DROPBEAR_SERVER || (channel->writefd != STDOUT_FILENO)) {
 		/* close the FDs in case they haven't been done
@@ -689,6 +703,16 @@ void recv_msg_channel_request() {
 
 }
 
+/* Discards a partly built channel data packet */
+static void send_msg_channel_data_abort(buffer *writebuf) {
+	if (writebuf) {
+		buf_pool_put(&ses.bufpool, writebuf, 1);
+	} else {
+		buf_setpos(ses.writepayload, 0);
+		buf_setlen(ses.writepayload, 0);
+	}
+}
+
 /* Reads data from the server's program/shell/etc, and puts it in a
  * channel_data packet to send.
  * chan is the remote channel, isextended is 0 if it is normal data, 1
@@ -699,6 +723,7 @@ static void send_msg_channel_data(struct Channel *channel, int isextended) {
 	int len;
 	size_t maxlen, size_pos;
 	int fd;
+	buffer *buf = NULL, *writebuf = NULL;
 
 	CHECKCLEARTOWRITE();
 
@@ -724,18 +749,27 @@ static void send_msg_channel_data(struct Channel *channel, int isextended) {
 		return;
 	}
 
-	buf_putbyte(ses.writepayload, 
+	/* Read straight into the outgoing packet where possible, otherwise
+	 * the data goes via ses.writepayload */
+	writebuf = direct_packet_new(1 + 4 + 4 + (isextended ? 4 : 0) + maxlen);
+	if (writebuf) {
+		buf = writebuf;
+	} else {
+		buf = ses.writepayload;
+	}
+
+	buf_putbyte(buf, 
 			isextended ? SSH_MSG_CHANNEL_EXTENDED_DATA : SSH_MSG_CHANNEL_DATA);
-	buf_putint(ses.writepayload, channel->remotechan);
+	buf_putint(buf, channel->remotechan);
 	if (isextended) {
-		buf_putint(ses.writepayload, SSH_EXTENDED_DATA_STDERR);
+		buf_putint(buf, SSH_EXTENDED_DATA_STDERR);
 	}
 	/* a dummy size first ...*/
-	size_pos = ses.writepayload->pos;
-	buf_putint(ses.writepayload, 0);
+	size_pos = buf->pos;
+	buf_putint(buf, 0);
 
 	/* read the data */
-	len = read(fd, buf_getwriteptr(ses.writepayload, maxlen), maxlen);
+	len = read(fd, buf_getwriteptr(buf, maxlen), maxlen);
 
 	if (len <= 0) {
 		if (len == 0 || errno != EINTR) {
@@ -744,31 +778,33 @@ static void send_msg_channel_data(struct Channel *channel, int isextended) {
 			in which case it can be treated the same as EOF */
 			close_chan_fd(channel, fd, SHUT_RD);
 		}
-		buf_setpos(ses.writepayload, 0);
-		buf_setlen(ses.writepayload, 0);
+		send_msg_channel_data_abort(writebuf);
 		TRACE(("leave send_msg_channel_data: len %d read err %d or EOF for fd %d", 
 					len, errno, fd))
 		return;
 	}
 
 	if (channel->read_mangler) {
-		channel->read_mangler(channel, buf_getwriteptr(ses.writepayload, len), &len);
+		channel->read_mangler(channel, buf_getwriteptr(buf, len), &len);
 		if (len == 0) {
-			buf_setpos(ses.writepayload, 0);
-			buf_setlen(ses.writepayload, 0);
+			send_msg_channel_data_abort(writebuf);
 			return;
 		}
 	}
 
 	TRACE(("send_msg_channel_data: len %d fd %d", len, fd))
-	buf_incrwritepos(ses.writepayload, len);
+	buf_incrwritepos(buf, len);
 	/* ... real size here */
-	buf_setpos(ses.writepayload, size_pos);
-	buf_putint(ses.writepayload, len);
+	buf_setpos(buf, size_pos);
+	buf_putint(buf, len);
 
 	channel->transwindow -= len;
 
-	encrypt_packet();
+	if (writebuf) {
+		direct_packet_encrypt(writebuf);
+	} else {
+		encrypt_packet();
+	}
 	TRACE(("leave send_msg_channel_data"))
 }
 
@@ -1055,8 +1091,10 @@ static void close_chan_fd(struct Channel *channel, int fd, int how) {
 		shutdown(fd, how);
 		if (how == 0) {
 			closeout = 1;
+			dbpoll_unset(fd, DBPOLL_READ);
 		} else {
 			closein = 1;
+			dbpoll_unset(fd, DBPOLL_WRITE);
 		}
 	} else {
 		TRACE(("CLOSE some fd %d", fd))
@@ -54,7 +54,7 @@ void send_msg_kexinit() {
 	buf_putbyte(ses.writepayload, SSH_MSG_KEXINIT);
 
 	/* cookie */
-	genrandom(buf_getwriteptr(ses.writepayload, 16), 16);
+	genrandom_fast(buf_getwriteptr(ses.writepayload, 16), 16);
 	buf_incrwritepos(ses.writepayload, 16);
 
 	/* kex algos */
@@ -297,6 +297,40 @@ static void hashkeys(unsigned char *out, unsigned int outlen,
  * ses.newkeys is the new set of keys which are generated, these are only
  * taken into use after both sides have sent a newkeys message */
 
+/* Sets up the HMAC inner and outer hash states for key->mackey, the
+ * hashes of the key XORed with ipad and opad. make_mac() continues from
+ * copies of these for each packet rather than hashing the key again. */
+static void hmac_precompute(struct key_context_directional *key) {
+	const struct ltc_hash_descriptor *hash_desc = &hash_descriptor[key->hash_index];
+	unsigned char pad[MAXBLOCKSIZE];
+	unsigned long blocksize, keylen, i;
+
+	blocksize = hash_desc->blocksize;
+	keylen = key->algo_mac->keysize;
+	/* hmac_init() would hash longer keys first, ours are never that long */
+	dropbear_assert(blocksize <= sizeof(pad) && keylen <= blocksize);
+
+	memset(pad, 0x0, blocksize);
+	memcpy(pad, key->mackey, keylen);
+	for (i = 0; i < blocksize; i++) {
+		pad[i] ^= 0x36;
+	}
+	if (hash_desc->init(&key->mac_inner) != CRYPT_OK
+		|| hash_desc->process(&key->mac_inner, pad, blocksize) != CRYPT_OK) {
+		dropbear_exit("HMAC error");
+	}
+
+	for (i = 0; i < blocksize; i++) {
+		pad[i] ^= 0x36 ^ 0x5c;
+	}
+	if (hash_desc->init(&key->mac_outer) != CRYPT_OK
+		|| hash_desc->process(&key->mac_outer, pad, blocksize) != CRYPT_OK) {
+		dropbear_exit("HMAC error");
+	}
+
+	m_burn(pad, sizeof(pad));
+}
+
 static void gen_new_keys() {
 
 	unsigned char C2S_IV[MAX_IV_LEN];
@@ -385,12 +419,14 @@ static void gen_new_keys() {
 		hashkeys(ses.newkeys->trans.mackey, 
 				ses.newkeys->trans.algo_mac->keysize, &hs, mactransletter);
 		ses.newkeys->trans.hash_index = find_hash(ses.newkeys->trans.algo_mac->hash_desc->name);
+		hmac_precompute(&ses.newkeys->trans);
 	}
 
 	if (ses.newkeys->recv.algo_mac->hash_desc != NULL) {
 		hashkeys(ses.newkeys->recv.mackey, 
 				ses.newkeys->recv.algo_mac->keysize, &hs, macrecvletter);
 		ses.newkeys->recv.hash_index = find_hash(ses.newkeys->recv.algo_mac->hash_desc->name);
+		hmac_precompute(&ses.newkeys->recv);
 	}
 
 	/* Ready to switch over */
@@ -57,6 +57,8 @@ void common_session_init(int sock_in, int sock_out) {
 	ses.sock_out = sock_out;
 	ses.maxfd = MAX(sock_in, sock_out);
 
+	dbpoll_init();
+
 	if (sock_in >= 0) {
 		setnonblocking(sock_in);
 	}
@@ -104,6 +106,7 @@ void common_session_init(int sock_in, int sock_out) {
 	ses.writepayload = buf_new(TRANS_MAX_PAYLOAD_LEN);
 	ses.transseq = 0;
 
+	ses.readring = buf_new_nozero(RECV_RING_LEN);
 	ses.readbuf = NULL;
 	ses.payload = NULL;
 	ses.recvseq = 0;
@@ -159,19 +162,14 @@ void common_session_init(int sock_in, int sock_out) {
 
 void session_loop(void(*loophandler)(void)) {
 
-	fd_set readfd, writefd;
-	struct timeval timeout;
 	int val;
+	int read_pending;
+	unsigned int npackets;
 
-	/* main loop, select()s for all sockets in use */
+	/* main loop, waits for all sockets in use */
 	for(;;) {
 		const int writequeue_has_space = (ses.writequeue_len <= 2*TRANS_MAX_PAYLOAD_LEN);
 
-		timeout.tv_sec = select_timeout();
-		timeout.tv_usec = 0;
-		DROPBEAR_FD_ZERO(&writefd);
-		DROPBEAR_FD_ZERO(&readfd);
-
 		dropbear_assert(ses.payload == NULL);
 
 		/* We get woken up when signal handlers write to this pipe.
@@ -180,14 +178,14 @@ void session_loop(void(*loophandler)(void)) {
 		if (!fuzz.fuzzing) 
 #endif
 		{
-		FD_SET(ses.signal_pipe[0], &readfd);
+		dbpoll_set(ses.signal_pipe[0], DBPOLL_READ);
 		}
 
 		/* set up for channels which can be read/written */
-		setchannelfds(&readfd, &writefd, writequeue_has_space);
+		setchannelfds(writequeue_has_space);
 
 		/* Pending connections to test */
-		set_connect_fds(&writefd);
+		set_connect_fds();
 
 		/* We delay reading from the input socket during initial setup until
 		after we have written out our initial KEXINIT packet (empty writequeue). 
@@ -195,19 +193,27 @@ void session_loop(void(*loophandler)(void)) {
 		read for the remote ident.
 		We also avoid reading from the socket if the writequeue is full, that avoids
 		replies backing up */
-		if (ses.sock_in != -1 
-			&& (ses.remoteident || isempty(&ses.writequeue)) 
+		if ((ses.remoteident || isempty(&ses.writequeue)) 
 			&& writequeue_has_space) {
-			FD_SET(ses.sock_in, &readfd);
+			dbpoll_set(ses.sock_in, DBPOLL_READ);
+		} else {
+			dbpoll_unset(ses.sock_in, DBPOLL_READ);
 		}
 
 		/* Ordering is important, this test must occur after any other function
 		might have queued packets (such as connection handlers) */
-		if (ses.sock_out != -1 && !isempty(&ses.writequeue)) {
-			FD_SET(ses.sock_out, &writefd);
+		if (!isempty(&ses.writequeue)) {
+			dbpoll_set(ses.sock_out, DBPOLL_WRITE);
+		} else {
+			dbpoll_unset(ses.sock_out, DBPOLL_WRITE);
 		}
 
-		val = select(ses.maxfd+1, &readfd, &writefd, NULL, &timeout);
+		/* Packets already read from the socket are handled without
+		waiting, subject to the same writequeue limit */
+		read_pending = ses.sock_in != -1 && writequeue_has_space
+			&& read_packet_pending();
+
+		val = dbpoll_wait(read_pending ? 0 : select_timeout());
 
 		if (ses.exitflag) {
 			dropbear_exit("Terminated by signal");
@@ -222,15 +228,14 @@ void session_loop(void(*loophandler)(void)) {
 			 * want to iterate over channels etc for reading, to handle
 			 * server processes exiting etc. 
 			 * We don't want to read/write FDs. */
-			DROPBEAR_FD_ZERO(&writefd);
-			DROPBEAR_FD_ZERO(&readfd);
+			dbpoll_clear();
 		}
 		
 		/* We'll just empty out the pipe if required. We don't do
 		any thing with the data, since the pipe's purpose is purely to
 		wake up the select() above. */
 		ses.channel_signal_pending = 0;
-		if (FD_ISSET(ses.signal_pipe[0], &readfd)) {
+		if (dbpoll_isset(ses.signal_pipe[0], DBPOLL_READ)) {
 			char x;
 			TRACE(("signal pipe set"))
 			while (read(ses.signal_pipe[0], &x, 1) > 0) {}
@@ -242,7 +247,7 @@ void session_loop(void(*loophandler)(void)) {
 
 		/* process session socket's incoming data */
 		if (ses.sock_in != -1) {
-			if (FD_ISSET(ses.sock_in, &readfd)) {
+			if (dbpoll_isset(ses.sock_in, DBPOLL_READ) || read_pending) {
 				if (!ses.remoteident) {
 					/* blocking read of the version string */
 					read_session_identification();
@@ -252,9 +257,23 @@ void session_loop(void(*loophandler)(void)) {
 			}
 			
 			/* Process the decrypted packet. After this, the read buffer
-			 * will be ready for a new packet */
-			if (ses.payload != NULL) {
+			 * will be ready for a new packet. Further packets that came
+			 * in with the same read() are processed here too, up to a
+			 * limit so that channels still get a turn. Transport
+			 * layer packets (KEX etc) stop that, the loophandler
+			 * expects to see each of those as ses.lastpacket */
+			for (npackets = 0; ses.payload != NULL; ) {
 				process_packet();
+				npackets++;
+				if (npackets >= RECV_MAX_PACKETS_PER_LOOP
+					|| ses.lastpacket < SSH_MSG_USERAUTH_REQUEST
+					|| !ses.dataallowed
+					|| ses.sock_in == -1
+					|| ses.writequeue_len > 2*TRANS_MAX_PAYLOAD_LEN
+					|| !read_packet_pending()) {
+					break;
+				}
+				read_packet();
 			}
 		}
 
@@ -262,7 +281,7 @@ void session_loop(void(*loophandler)(void)) {
 		were being held up during a KEX */
 		maybe_flush_reply_queue();
 
-		handle_connect_fds(&writefd);
+		handle_connect_fds();
 
 		/* loop handler prior to channelio, in case the server loophandler closes
 		channels on process exit */
@@ -270,7 +289,7 @@ void session_loop(void(*loophandler)(void)) {
 
 		/* process pipes etc for the channels, ses.dataallowed == 0
 		 * during rekeying ) */
-		channelio(&readfd, &writefd);
+		channelio();
 
 		/* process session socket's outgoing data */
 		if (ses.sock_out != -1) {
@@ -346,11 +365,17 @@ void session_cleanup() {
 	m_free(ses.authstate.pw_shell);
 	m_free(ses.authstate.pw_passwd);
 	m_free(ses.authstate.username);
+
+	dbpoll_cleanup();
 #endif
 
 	cleanup_buf(&ses.session_id);
 	cleanup_buf(&ses.hash);
 	cleanup_buf(&ses.payload);
+	cleanup_buf(&ses.readring);
+	TRACE(("packet buffers reused %lu, allocated %lu",
+		ses.bufpool.reused, ses.bufpool.allocated))
+	buf_pool_cleanup(&ses.bufpool);
 	cleanup_buf(&ses.readbuf);
 	cleanup_buf(&ses.writepayload);
 	cleanup_buf(&ses.kexhashbuf);
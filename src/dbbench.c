@@ -0,0 +1,326 @@
+/* Microbenchmarks for hot paths, not installed. Build with "make dbbench"
+ * and run "./dbbench [name ...]", with no arguments all are run. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "dbrandom.h"
+#include "crypto_desc.h"
+#include "session.h"
+#include "packet.h"
+#include "dbpoll.h"
+
+struct dbbench {
+	const char *name;
+	void (*run)(void);
+};
+
+/* The poller lives in the session state */
+struct sshsession ses;
+
+static double elapsed_since(const struct timespec *start) {
+	struct timespec now;
+	gettime_wrapper(&now);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Prints the time per iteration for a completed loop */
+static void report(const char *what, const struct timespec *start,
+		unsigned long iterations, const char *unit) {
+	double secs = elapsed_since(start);
+	printf("%-40s %10.1f ns/%s\n", what, secs * 1e9 / iterations, unit);
+}
+
+/* Packet padding, 4 to 19 bytes as for a 16 byte blocksize */
+#define PADDING_PACKETS 2000000
+
+static void bench_padding_generator(const char *what,
+		void (*gen)(unsigned char*, unsigned int)) {
+	unsigned char pad[32];
+	struct timespec start;
+	unsigned long i;
+
+	gettime_wrapper(&start);
+	for (i = 0; i < PADDING_PACKETS; i++) {
+		gen(pad, 4 + (i % 16));
+	}
+	report(what, &start, PADDING_PACKETS, "packet");
+}
+
+static void bench_padding() {
+	bench_padding_generator("padding genrandom()", genrandom);
+	bench_padding_generator("padding genrandom_fast()", genrandom_fast);
+}
+
+/* Seeding done by the listener for each connection */
+#define SEED_ITERATIONS 2000
+
+static void bench_seed() {
+	struct timespec start;
+	unsigned long i;
+
+	gettime_wrapper(&start);
+	for (i = 0; i < SEED_ITERATIONS; i++) {
+		seedrandom();
+	}
+	report("seedrandom()", &start, SEED_ITERATIONS, "call");
+
+	gettime_wrapper(&start);
+	for (i = 0; i < SEED_ITERATIONS; i++) {
+		reseedrandom();
+	}
+	report("reseedrandom()", &start, SEED_ITERATIONS, "call");
+}
+
+/* Packet buffer churn of a bulk transfer, with the same buffer sizes as
+ * packet.c. A received packet starts in a small buffer that's replaced
+ * once its length is known, and is released after processing. A sent
+ * packet's buffer is released once it has been written. */
+#define BUFPOOL_PACKETS 1000000
+#define BUFPOOL_PACKET_LEN (16384 + 64)
+
+static buffer* bufpool_get(struct buf_pool *pool, unsigned int size) {
+	return pool ? buf_pool_get(pool, size) : buf_new(size);
+}
+
+static void bufpool_put(struct buf_pool *pool, buffer *buf) {
+	if (pool) {
+		buf_pool_put(pool, buf, 1);
+	} else {
+		buf_burn_free(buf);
+	}
+}
+
+static void bench_bufpool_one(const char *what, struct buf_pool *pool) {
+	buffer *init, *recv, *send;
+	struct timespec start;
+	unsigned long i;
+
+	gettime_wrapper(&start);
+	for (i = 0; i < BUFPOOL_PACKETS; i++) {
+		init = bufpool_get(pool, INIT_READBUF);
+		recv = bufpool_get(pool, BUFPOOL_PACKET_LEN);
+		bufpool_put(pool, init);
+		send = bufpool_get(pool, TRANS_MAX_PAYLOAD_LEN + 128);
+		buf_setlen(send, TRANS_MAX_PAYLOAD_LEN);
+		buf_setlen(recv, BUFPOOL_PACKET_LEN);
+		bufpool_put(pool, recv);
+		bufpool_put(pool, send);
+	}
+	report(what, &start, BUFPOOL_PACKETS, "packet");
+}
+
+static void bench_bufpool() {
+	struct buf_pool pool;
+
+	memset(&pool, 0x0, sizeof(pool));
+	bench_bufpool_one("packet buffers buf_new()", NULL);
+	bench_bufpool_one("packet buffers buf_pool_get()", &pool);
+	printf("%-40s %10lu of %lu\n", "packet buffers reused",
+		pool.reused, pool.reused + pool.allocated);
+	buf_pool_cleanup(&pool);
+}
+
+/* A session loop wakeup with one busy fd among many idle ones, such as
+ * a server with many open channels. The idle fds are dups of one pipe
+ * that is never written. */
+#define POLL_ITERATIONS 200000
+
+static void bench_poll_idle(unsigned int nidle) {
+	char what[50], c = 0;
+	int idle[2], busy[2];
+	int *dups = NULL;
+	struct timespec start;
+	unsigned long i;
+	unsigned int j;
+
+	if (pipe(idle) < 0 || pipe(busy) < 0) {
+		dropbear_exit("pipe failed");
+	}
+	dups = m_malloc((nidle + 1) * sizeof(*dups));
+	for (j = 0; j < nidle; j++) {
+		dups[j] = dup(idle[0]);
+		if (dups[j] < 0) {
+			printf("poll: only %u fds available\n", j);
+			nidle = j;
+			break;
+		}
+	}
+
+	dbpoll_init();
+	for (j = 0; j < nidle; j++) {
+		dbpoll_set(dups[j], DBPOLL_READ);
+	}
+	dbpoll_set(busy[0], DBPOLL_READ);
+
+	gettime_wrapper(&start);
+	for (i = 0; i < POLL_ITERATIONS; i++) {
+		if (write(busy[1], &c, 1) != 1
+				|| dbpoll_wait(0) != 1
+				|| !dbpoll_isset(busy[0], DBPOLL_READ)
+				|| read(busy[0], &c, 1) != 1) {
+			dropbear_exit("poll failed");
+		}
+	}
+	snprintf(what, sizeof(what), "dbpoll_wait() %u idle fds", nidle);
+	report(what, &start, POLL_ITERATIONS, "wakeup");
+
+	dbpoll_cleanup();
+	for (j = 0; j < nidle; j++) {
+		close(dups[j]);
+	}
+	m_free(dups);
+	close(idle[0]);
+	close(idle[1]);
+	close(busy[0]);
+	close(busy[1]);
+}
+
+static void bench_poll() {
+	struct rlimit lim;
+
+	/* Use as many fds as we're allowed */
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+
+	bench_poll_idle(0);
+	bench_poll_idle(100);
+	bench_poll_idle(10000);
+}
+
+/* Connection rate of a running server (DBBENCH_HOST, DBBENCH_PORT), up to
+ * the point where its ident string arrives. Each client process uses its own
+ * loopback source address so per-source unauthenticated limits aren't hit. */
+#define HANDSHAKE_CLIENTS 8
+#define HANDSHAKE_SECONDS 5
+
+/* Returns 0 on success */
+static int handshake_once(const struct sockaddr_in *dest, const struct sockaddr_in *src) {
+	char buf[256];
+	ssize_t len;
+	int sock, ret = -1;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	if (src && bind(sock, (const struct sockaddr*)src, sizeof(*src)) < 0) {
+		goto out;
+	}
+	if (connect(sock, (const struct sockaddr*)dest, sizeof(*dest)) < 0) {
+		goto out;
+	}
+	/* SSH-2.0-... arrives in a single segment */
+	len = read(sock, buf, sizeof(buf));
+	if (len >= 4 && memcmp(buf, "SSH-", 4) == 0) {
+		ret = 0;
+	}
+out:
+	close(sock);
+	return ret;
+}
+
+static void bench_handshake() {
+	struct sockaddr_in dest, src;
+	const char *host = getenv("DBBENCH_HOST");
+	const char *port = getenv("DBBENCH_PORT");
+	struct timespec start;
+	unsigned long count, total = 0;
+	int loopback, c, p[2];
+	pid_t pid;
+
+	memset(&dest, 0x0, sizeof(dest));
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons(port ? atoi(port) : 2299);
+	if (inet_pton(AF_INET, host ? host : "127.0.0.1", &dest.sin_addr) != 1) {
+		fprintf(stderr, "handshake: DBBENCH_HOST must be an IPv4 address\n");
+		return;
+	}
+	loopback = (ntohl(dest.sin_addr.s_addr) >> 24) == 127;
+
+	if (handshake_once(&dest, NULL) != 0) {
+		printf("%-40s skipped, no server at %s:%d\n", "handshake",
+			host ? host : "127.0.0.1", ntohs(dest.sin_port));
+		return;
+	}
+
+	if (pipe(p) < 0) {
+		dropbear_exit("pipe failed");
+	}
+	gettime_wrapper(&start);
+	for (c = 0; c < HANDSHAKE_CLIENTS; c++) {
+		pid = fork();
+		if (pid < 0) {
+			dropbear_exit("fork failed");
+		}
+		if (pid == 0) {
+			memset(&src, 0x0, sizeof(src));
+			src.sin_family = AF_INET;
+			src.sin_addr.s_addr = htonl(0x7f000100 + 1 + c); /* 127.0.1.x */
+			count = 0;
+			while (elapsed_since(&start) < HANDSHAKE_SECONDS) {
+				if (handshake_once(&dest, loopback ? &src : NULL) == 0) {
+					count++;
+				}
+			}
+			if (write(p[1], &count, sizeof(count)) != sizeof(count)) {
+				_exit(EXIT_FAILURE);
+			}
+			_exit(EXIT_SUCCESS);
+		}
+	}
+	close(p[1]);
+	while (read(p[0], &count, sizeof(count)) == sizeof(count)) {
+		total += count;
+	}
+	close(p[0]);
+	while (wait(NULL) > 0) {
+		/* reap clients */
+	}
+	printf("%-40s %10.1f conn/s\n", "handshake (to server ident)",
+		total / elapsed_since(&start));
+}
+
+static const struct dbbench benchmarks[] = {
+	{"padding", bench_padding},
+	{"seed", bench_seed},
+	{"poll", bench_poll},
+	{"bufpool", bench_bufpool},
+	{"handshake", bench_handshake},
+	{NULL, NULL}
+};
+
+int main(int argc, char ** argv) {
+	const struct dbbench *b = NULL;
+	int i, found;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			fprintf(stderr, "Usage: %s [name ...]\nBenchmarks:", argv[0]);
+			for (b = benchmarks; b->name; b++) {
+				fprintf(stderr, " %s", b->name);
+			}
+			fprintf(stderr, "\n");
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	crypto_init();
+	seedrandom();
+
+	for (b = benchmarks; b->name; b++) {
+		found = (argc == 1);
+		for (i = 1; i < argc; i++) {
+			if (strcmp(argv[i], b->name) == 0) {
+				found = 1;
+			}
+		}
+		if (found) {
+			b->run();
+		}
+	}
+
+	exit(EXIT_SUCCESS);
+}
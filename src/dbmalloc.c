@@ -40,6 +40,21 @@ void * m_malloc(size_t size) {
 
 }
 
+void * m_malloc_nozero(size_t size) {
+
+	void* ret;
+
+	if (size == 0) {
+		dropbear_exit("m_malloc failed");
+	}
+	ret = malloc(size);
+	if (ret == NULL) {
+		dropbear_exit("m_malloc failed");
+	}
+	return ret;
+
+}
+
 void * m_realloc(void* ptr, size_t size) {
 
 	void *ret;
@@ -148,6 +163,28 @@ void * m_malloc(size_t size) {
     return &mem[sizeof(struct dbmalloc_header)];
 }
 
+void * m_malloc_nozero(size_t size) {
+    char* mem = NULL;
+    struct dbmalloc_header* header = NULL;
+
+    if (size == 0 || size > 1e9) {
+        dropbear_exit("m_malloc failed");
+    }
+
+    size = size + sizeof(struct dbmalloc_header);
+
+    mem = malloc(size);
+    if (mem == NULL) {
+        dropbear_exit("m_malloc failed");
+    }
+    header = (struct dbmalloc_header*)mem;
+    header->prev = NULL;
+    header->next = NULL;
+    put_alloc(header);
+    header->epoch = current_epoch;
+    return &mem[sizeof(struct dbmalloc_header)];
+}
+
 void * m_realloc(void* ptr, size_t size) {
     char* mem = NULL;
     struct dbmalloc_header* header = NULL;
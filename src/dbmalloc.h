@@ -6,6 +6,9 @@
 #include <stdlib.h>
 
 void * m_malloc(size_t size);
+/* Like m_malloc() but the memory isn't zeroed. Only for callers that
+ * write memory before reading it */
+void * m_malloc_nozero(size_t size);
 void * m_calloc(size_t nmemb, size_t size);
 void * m_strdup(const char * str);
 void * m_realloc(void* ptr, size_t size);
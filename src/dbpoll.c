@@ -0,0 +1,480 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "session.h"
+#include "dbpoll.h"
+
+/* dbpoll_fd.flags */
+#define DBPOLL_F_CHANGED 1 /* present in the changed list */
+#define DBPOLL_F_SCAN 2 /* present in the scan list */
+#define DBPOLL_F_NOPOLL 4 /* epoll refused the fd (regular files etc) */
+
+#define DBPOLL_INITIAL_FDS 64
+#define DBPOLL_INITIAL_LIST 16
+
+static void dbpoll_fd_closed(int fd);
+
+static void list_init(struct dbpoll_list *l) {
+	l->size = DBPOLL_INITIAL_LIST;
+	l->fds = m_malloc(l->size * sizeof(*l->fds));
+	l->len = 0;
+}
+
+static void list_add(struct dbpoll_list *l, int fd) {
+	if (l->len == l->size) {
+		l->size *= 2;
+		l->fds = m_realloc(l->fds, l->size * sizeof(*l->fds));
+	}
+	l->fds[l->len] = fd;
+	l->len++;
+}
+
+void dbpoll_init() {
+	struct dropbear_poller *p = &ses.poller;
+
+	if (p->fds) {
+		/* Inherited from the listening parent */
+		dbpoll_cleanup();
+	}
+
+	p->fdsize = DBPOLL_INITIAL_FDS;
+	p->fds = m_malloc(p->fdsize * sizeof(*p->fds));
+	list_init(&p->changed);
+	list_init(&p->ready);
+	list_init(&p->scan);
+	p->epfd = -1;
+	p->owner = getpid();
+
+#if DROPBEAR_EPOLL
+	p->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (p->epfd < 0) {
+		TRACE(("epoll_create1 failed, falling back to select: %s", strerror(errno)))
+	}
+	p->eventsize = DBPOLL_INITIAL_LIST;
+	p->events = m_malloc(p->eventsize * sizeof(*p->events));
+#endif
+
+	_dropbear_close_hook = dbpoll_fd_closed;
+}
+
+void dbpoll_cleanup() {
+	struct dropbear_poller *p = &ses.poller;
+
+	_dropbear_close_hook = NULL;
+	/* For an inherited poller this only drops our reference, the
+	 * parent's registrations are unaffected */
+	m_close(p->epfd);
+	m_free(p->fds);
+	m_free(p->changed.fds);
+	m_free(p->ready.fds);
+	m_free(p->scan.fds);
+#if DROPBEAR_EPOLL
+	m_free(p->events);
+#endif
+	memset(p, 0x0, sizeof(*p));
+	p->epfd = -1;
+}
+
+/* Records a change in interest, passed on at the next dbpoll_wait() */
+static void mark_changed(struct dropbear_poller *p, int fd) {
+	struct dbpoll_fd *f = &p->fds[fd];
+
+	if (!(f->flags & DBPOLL_F_CHANGED)) {
+		list_add(&p->changed, fd);
+		f->flags |= DBPOLL_F_CHANGED;
+	}
+}
+
+void dbpoll_set(int fd, int events) {
+	struct dropbear_poller *p = &ses.poller;
+	struct dbpoll_fd *f = NULL;
+
+	if (fd < 0) {
+		return;
+	}
+
+	if ((unsigned int)fd >= p->fdsize) {
+		unsigned int newsize = MAX(p->fdsize * 2, (unsigned int)fd + 1);
+		p->fds = m_realloc(p->fds, newsize * sizeof(*p->fds));
+		memset(&p->fds[p->fdsize], 0x0, (newsize - p->fdsize) * sizeof(*p->fds));
+		p->fdsize = newsize;
+	}
+
+	f = &p->fds[fd];
+	if ((f->want | events) != f->want) {
+		f->want |= events;
+		mark_changed(p, fd);
+	}
+}
+
+void dbpoll_unset(int fd, int events) {
+	struct dropbear_poller *p = &ses.poller;
+	struct dbpoll_fd *f = NULL;
+
+	if (fd < 0 || (unsigned int)fd >= p->fdsize) {
+		return;
+	}
+
+	f = &p->fds[fd];
+	if (f->want & events) {
+		f->want &= ~events;
+		mark_changed(p, fd);
+	}
+}
+
+int dbpoll_isset(int fd, int events) {
+	const struct dropbear_poller *p = &ses.poller;
+
+	if (fd < 0 || (unsigned int)fd >= p->fdsize) {
+		return 0;
+	}
+	return (p->fds[fd].ready & events) != 0;
+}
+
+unsigned int dbpoll_ready(const int **fds) {
+	const struct dropbear_poller *p = &ses.poller;
+
+	*fds = p->ready.fds;
+	return p->ready.len;
+}
+
+void dbpoll_clear() {
+	struct dropbear_poller *p = &ses.poller;
+	unsigned int i;
+
+	for (i = 0; i < p->ready.len; i++) {
+		p->fds[p->ready.fds[i]].ready = 0;
+	}
+	p->ready.len = 0;
+}
+
+/* Called by m_close() prior to closing fd. The kernel only drops an epoll
+ * registration once every reference to the file is closed, so if the fd
+ * is shared with a child process we'd keep getting events for a stale
+ * fd number. Remove it explicitly. */
+static void dbpoll_fd_closed(int fd) {
+	struct dropbear_poller *p = &ses.poller;
+	struct dbpoll_fd *f = NULL;
+
+	if (fd < 0 || (unsigned int)fd >= p->fdsize) {
+		return;
+	}
+	f = &p->fds[fd];
+
+	/* A child between fork() and exec() shares the epoll instance with
+	 * the parent (and after vfork() this memory too), leave both alone. */
+	if (getpid() != p->owner) {
+		return;
+	}
+
+#if DROPBEAR_EPOLL
+	if (p->epfd >= 0 && f->registered) {
+		if (epoll_ctl(p->epfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+			TRACE(("epoll_ctl del %d failed: %s", fd, strerror(errno)))
+		}
+	}
+#endif
+	/* Entries left in the lists are dropped when they are next looked at */
+	f->want = 0;
+	f->registered = 0;
+	f->ready = 0;
+	f->flags &= ~DBPOLL_F_NOPOLL;
+}
+
+#if DROPBEAR_EPOLL
+/* Passes a change in interest for fd to the kernel */
+static void epoll_update(const struct dropbear_poller *p, int fd, struct dbpoll_fd *f) {
+	struct epoll_event ev;
+	int op, res;
+
+	memset(&ev, 0x0, sizeof(ev));
+	ev.data.fd = fd;
+	if (f->want & DBPOLL_READ) {
+		ev.events |= EPOLLIN;
+	}
+	if (f->want & DBPOLL_WRITE) {
+		ev.events |= EPOLLOUT;
+	}
+
+	if (f->want == 0) {
+		op = EPOLL_CTL_DEL;
+	} else if (f->registered == 0) {
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	res = epoll_ctl(p->epfd, op, fd, &ev);
+	/* Our idea of the registration can only be out of date if an fd
+	 * was closed without m_close(), recover anyway */
+	if (res < 0 && op == EPOLL_CTL_ADD && errno == EEXIST) {
+		res = epoll_ctl(p->epfd, EPOLL_CTL_MOD, fd, &ev);
+	} else if (res < 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+		res = epoll_ctl(p->epfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	if (res < 0 && op != EPOLL_CTL_DEL) {
+		if (errno == EPERM) {
+			/* Regular files or /dev/null can't be polled. select()
+			 * treats them as always ready so we do the same. */
+			TRACE(("fd %d can't be used with epoll", fd))
+			f->flags |= DBPOLL_F_NOPOLL;
+			f->registered = 0;
+			return;
+		}
+		dropbear_exit("Error in epoll_ctl: %s", strerror(errno));
+	}
+
+	f->registered = f->want;
+}
+
+/* The session carried on in a forked process (dbclient -f uses daemon()).
+ * The epoll instance is still shared with the exited parent's file and
+ * closes aren't passed on to it by dbpoll_fd_closed(), so make a new
+ * one and register everything again. */
+static void epoll_reown(struct dropbear_poller *p) {
+	unsigned int fd;
+
+	TRACE(("dbpoll: new epoll instance for pid %d", (int)getpid()))
+	m_close(p->epfd);
+	p->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (p->epfd < 0) {
+		TRACE(("epoll_create1 failed, falling back to select: %s", strerror(errno)))
+	}
+	for (fd = 0; fd < p->fdsize; fd++) {
+		struct dbpoll_fd *f = &p->fds[fd];
+		f->registered = 0;
+		if (f->want) {
+			mark_changed(p, fd);
+		}
+	}
+}
+#endif
+
+/* Passes changes in interest on to the kernel, or to the scan list for
+ * fds that it doesn't watch */
+static void apply_changes(struct dropbear_poller *p) {
+	unsigned int i;
+
+	for (i = 0; i < p->changed.len; i++) {
+		const int fd = p->changed.fds[i];
+		struct dbpoll_fd *f = &p->fds[fd];
+
+		f->flags &= ~DBPOLL_F_CHANGED;
+#if DROPBEAR_EPOLL
+		if (p->epfd >= 0 && !(f->flags & DBPOLL_F_NOPOLL)
+				&& f->want != f->registered) {
+			epoll_update(p, fd, f);
+		}
+		if (p->epfd >= 0 && !(f->flags & DBPOLL_F_NOPOLL)) {
+			continue;
+		}
+#endif
+		if (f->want && !(f->flags & DBPOLL_F_SCAN)) {
+			list_add(&p->scan, fd);
+			f->flags |= DBPOLL_F_SCAN;
+		}
+	}
+	p->changed.len = 0;
+}
+
+/* Drops scan list entries that no longer have interest, or that the
+ * kernel watches since the fd number was reused */
+static void prune_scan(struct dropbear_poller *p) {
+	unsigned int i;
+
+	for (i = 0; i < p->scan.len; ) {
+		const int fd = p->scan.fds[i];
+		struct dbpoll_fd *f = &p->fds[fd];
+
+		if (f->want == 0
+				|| (p->epfd >= 0 && !(f->flags & DBPOLL_F_NOPOLL))) {
+			f->flags &= ~DBPOLL_F_SCAN;
+			p->scan.len--;
+			p->scan.fds[i] = p->scan.fds[p->scan.len];
+			continue;
+		}
+		i++;
+	}
+}
+
+/* Records a result for fd */
+static void set_ready(struct dropbear_poller *p, int fd, unsigned char ready) {
+	if (ready) {
+		p->fds[fd].ready = ready;
+		list_add(&p->ready, fd);
+	}
+}
+
+#if DROPBEAR_EPOLL
+static int epoll_backend_wait(struct dropbear_poller *p, long timeout) {
+	int ms, n, i;
+
+	if (timeout < 0) {
+		ms = -1;
+	} else {
+		ms = MIN(timeout, INT_MAX / 1000) * 1000;
+	}
+
+	n = epoll_wait(p->epfd, p->events, p->eventsize, ms);
+
+	for (i = 0; i < n; i++) {
+		const unsigned int ev = p->events[i].events;
+		const int fd = p->events[i].data.fd;
+		const struct dbpoll_fd *f = &p->fds[fd];
+		unsigned char ready = 0;
+
+		if (ev & EPOLLIN) {
+			ready |= DBPOLL_READ;
+		}
+		if (ev & EPOLLOUT) {
+			ready |= DBPOLL_WRITE;
+		}
+		if (ev & (EPOLLERR|EPOLLHUP)) {
+			/* select() reports errors as readiness, let the
+			 * read() or write() find the problem */
+			ready |= f->registered;
+		}
+		set_ready(p, fd, ready & f->registered);
+	}
+
+	if (n > 0 && (unsigned int)n == p->eventsize) {
+		/* Level triggered, so the rest are reported next time */
+		p->eventsize *= 2;
+		p->events = m_realloc(p->events, p->eventsize * sizeof(*p->events));
+	}
+
+	return n;
+}
+#endif /* DROPBEAR_EPOLL */
+
+static int select_backend_wait(struct dropbear_poller *p, long timeout) {
+	fd_set readfd, writefd;
+	struct timeval tv, *tvp = NULL;
+	int maxfd = -1;
+	unsigned int i;
+	int val;
+
+	DROPBEAR_FD_ZERO(&readfd);
+	DROPBEAR_FD_ZERO(&writefd);
+
+	for (i = 0; i < p->scan.len; i++) {
+		const int fd = p->scan.fds[i];
+		const struct dbpoll_fd *f = &p->fds[fd];
+		if (f->flags & DBPOLL_F_NOPOLL) {
+			continue;
+		}
+		if (fd >= FD_SETSIZE) {
+			dropbear_exit("fd %d too large for select", fd);
+		}
+		if (f->want & DBPOLL_READ) {
+			FD_SET(fd, &readfd);
+		}
+		if (f->want & DBPOLL_WRITE) {
+			FD_SET(fd, &writefd);
+		}
+		maxfd = MAX(maxfd, fd);
+	}
+
+	if (timeout >= 0) {
+		tv.tv_sec = timeout;
+		tv.tv_usec = 0;
+		tvp = &tv;
+	}
+
+	val = select(maxfd+1, &readfd, &writefd, NULL, tvp);
+
+	if (val > 0) {
+		for (i = 0; i < p->scan.len; i++) {
+			const int fd = p->scan.fds[i];
+			unsigned char ready = 0;
+			if (p->fds[fd].flags & DBPOLL_F_NOPOLL) {
+				continue;
+			}
+			if (FD_ISSET(fd, &readfd)) {
+				ready |= DBPOLL_READ;
+			}
+			if (FD_ISSET(fd, &writefd)) {
+				ready |= DBPOLL_WRITE;
+			}
+			set_ready(p, fd, ready);
+		}
+	}
+
+	return val;
+}
+
+int dbpoll_wait(long timeout) {
+	struct dropbear_poller *p = &ses.poller;
+	unsigned int i;
+	int nopoll = 0;
+	int ret;
+
+	if (getpid() != p->owner) {
+#if DROPBEAR_EPOLL
+		if (p->epfd >= 0) {
+			epoll_reown(p);
+		}
+#endif
+		p->owner = getpid();
+	}
+
+	dbpoll_clear();
+	apply_changes(p);
+	prune_scan(p);
+
+	for (i = 0; i < p->scan.len; i++) {
+		if (p->fds[p->scan.fds[i]].flags & DBPOLL_F_NOPOLL) {
+			nopoll = 1;
+		}
+	}
+	if (nopoll) {
+		/* Don't block when an always-ready fd is waiting */
+		timeout = 0;
+	}
+
+#if DROPBEAR_EPOLL
+	if (p->epfd >= 0) {
+		ret = epoll_backend_wait(p, timeout);
+	} else
+#endif
+	{
+		ret = select_backend_wait(p, timeout);
+	}
+
+	if (ret >= 0 && nopoll) {
+		for (i = 0; i < p->scan.len; i++) {
+			const int fd = p->scan.fds[i];
+			const struct dbpoll_fd *f = &p->fds[fd];
+			if (f->flags & DBPOLL_F_NOPOLL) {
+				set_ready(p, fd, f->want);
+				ret++;
+			}
+		}
+	}
+
+	return ret;
+}
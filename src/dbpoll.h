@@ -0,0 +1,95 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_DBPOLL_H_
+#define DROPBEAR_DBPOLL_H_
+
+#include "includes.h"
+
+/* Readiness interest for dbpoll_set()/dbpoll_isset() */
+#define DBPOLL_READ 1
+#define DBPOLL_WRITE 2
+
+struct dbpoll_fd {
+	unsigned char want; /* interest set by dbpoll_set()/dbpoll_unset() */
+	unsigned char registered; /* interest currently held by the kernel (epoll) */
+	unsigned char ready; /* result of the most recent dbpoll_wait() */
+	unsigned char flags; /* DBPOLL_F_* in dbpoll.c */
+};
+
+/* A list of fds, each fd is present at most once */
+struct dbpoll_list {
+	int *fds;
+	unsigned int len;
+	unsigned int size;
+};
+
+/* Interest in an fd persists until it is changed with dbpoll_unset() or
+ * the fd is closed with m_close(). The epoll backend passes changes in
+ * interest on to the kernel at the next wait, and only looks at the fds
+ * that are ready, so the cost of a wait doesn't depend on the number of
+ * idle fds. The select() backend scans every fd with interest. */
+struct dropbear_poller {
+	int epfd; /* -1 for the select() backend */
+	pid_t owner; /* process that created epfd */
+
+	/* per-fd state, indexed by fd */
+	struct dbpoll_fd *fds;
+	unsigned int fdsize;
+
+	/* fds whose interest changed since the last wait */
+	struct dbpoll_list changed;
+	/* fds with a result from the last wait */
+	struct dbpoll_list ready;
+	/* fds with interest that the kernel doesn't watch for us: all of
+	 * them for select(), or those that epoll refused */
+	struct dbpoll_list scan;
+
+#if DROPBEAR_EPOLL
+	struct epoll_event *events;
+	unsigned int eventsize;
+#endif
+};
+
+/* Sets up ses.poller. A poller inherited from a parent process over
+ * fork() is discarded. */
+void dbpoll_init(void);
+void dbpoll_cleanup(void);
+/* Adds DBPOLL_READ/DBPOLL_WRITE interest in fd */
+void dbpoll_set(int fd, int events);
+/* Removes DBPOLL_READ/DBPOLL_WRITE interest in fd */
+void dbpoll_unset(int fd, int events);
+/* Waits for readiness. timeout is in seconds, negative to wait
+ * indefinitely. Returns the same as select() */
+int dbpoll_wait(long timeout);
+/* Whether fd was ready for any of events in the last dbpoll_wait() */
+int dbpoll_isset(int fd, int events);
+/* The fds that were ready in the last dbpoll_wait(), valid until the
+ * next wait or dbpoll_clear(). Returns the number of fds. An fd that has
+ * been closed since is still listed, dbpoll_isset() is false for it. */
+unsigned int dbpoll_ready(const int **fds);
+/* Forgets readiness results of the last dbpoll_wait() */
+void dbpoll_clear(void);
+
+#endif /* DROPBEAR_DBPOLL_H_ */
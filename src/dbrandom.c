@@ -39,6 +39,19 @@ static int donerandinit = 0;
 
 #define INIT_SEED_SIZE 32 /* 256 bits */
 
+#if DROPBEAR_FAST_RANDOM
+/* genrandom_fast() state. The key is replaced by each refill */
+#define FAST_KEY_LEN 32
+#define FAST_BUF_LEN 1024
+static unsigned char fast_key[FAST_KEY_LEN];
+static unsigned char fast_buf[FAST_BUF_LEN];
+/* unused bytes at the end of fast_buf */
+static unsigned int fast_avail = 0;
+static int fast_seeded = 0;
+
+static void fast_reset(void);
+#endif
+
 /* The basic setup is we read some data from /dev/(u)random or prngd and hash it
  * into hashpool. To read data, we hash together current hashpool contents,
  * and a counter. We feed more data in by hashing the current pool and new
@@ -127,6 +140,11 @@ void addrandom(const unsigned char * buf, unsigned int len)
 	/* new */
 	sha256_process(&hs, buf, len);
 	sha256_done(&hs, hashpool);
+
+#if DROPBEAR_FAST_RANDOM
+	/* After fork() the parent and child must not share buffered output */
+	fast_reset();
+#endif
 }
 
 static void write_urandom()
@@ -158,6 +176,9 @@ void fuzz_seed(const unsigned char* dat, unsigned int len) {
 	sha256_done(&hs, hashpool);
 	counter = 0;
 	donerandinit = 1;
+#if DROPBEAR_FAST_RANDOM
+	fast_reset();
+#endif
 }
 #endif
 
@@ -218,9 +239,9 @@ static int process_getrandom(hash_state *hs) {
 }
 #endif /* HAVE_GETRANDOM */
 
-/* Initialise the prng from /dev/urandom or prngd. This function can
- * be called multiple times */
-void seedrandom() {
+/* Hashes new seed data into the pool. full also reads the /proc
+ * sources and feeds the result back to /dev/urandom */
+static void seed_pool(int full) {
 	hash_state hs;
 
 	pid_t pid;
@@ -268,20 +289,22 @@ void seedrandom() {
 	/* A few other sources to fall back on. 
 	 * Add more here for other platforms */
 #ifdef __linux__
-	/* Might help on systems with wireless */
-	process_file(&hs, "/proc/interrupts", 0, 0);
-
-	process_file(&hs, "/proc/loadavg", 0, 0);
-	process_file(&hs, "/proc/sys/kernel/random/entropy_avail", 0, 0);
-
-	/* Mostly network visible but useful in some situations.
-	 * Limit size to avoid slowdowns on systems with lots of routes */
-	process_file(&hs, "/proc/net/netstat", 4096, 0);
-	process_file(&hs, "/proc/net/dev", 4096, 0);
-	process_file(&hs, "/proc/net/tcp", 4096, 0);
-	/* Also includes interface lo */
-	process_file(&hs, "/proc/net/rt_cache", 4096, 0);
-	process_file(&hs, "/proc/vmstat", 0, 0);
+	if (full) {
+		/* Might help on systems with wireless */
+		process_file(&hs, "/proc/interrupts", 0, 0);
+
+		process_file(&hs, "/proc/loadavg", 0, 0);
+		process_file(&hs, "/proc/sys/kernel/random/entropy_avail", 0, 0);
+
+		/* Mostly network visible but useful in some situations.
+		 * Limit size to avoid slowdowns on systems with lots of routes */
+		process_file(&hs, "/proc/net/netstat", 4096, 0);
+		process_file(&hs, "/proc/net/dev", 4096, 0);
+		process_file(&hs, "/proc/net/tcp", 4096, 0);
+		/* Also includes interface lo */
+		process_file(&hs, "/proc/net/rt_cache", 4096, 0);
+		process_file(&hs, "/proc/vmstat", 0, 0);
+	}
 #endif
 
 	pid = getpid();
@@ -303,10 +326,27 @@ void seedrandom() {
 
 	counter = 0;
 	donerandinit = 1;
+#if DROPBEAR_FAST_RANDOM
+	fast_reset();
+#endif
 
-	/* Feed it all back into /dev/urandom - this might help if Dropbear
-	 * is running from inetd and gets new state each time */
-	write_urandom();
+	if (full) {
+		/* Feed it all back into /dev/urandom - this might help if Dropbear
+		 * is running from inetd and gets new state each time */
+		write_urandom();
+	}
+}
+
+/* Initialise the prng from /dev/urandom or prngd. This function can
+ * be called multiple times */
+void seedrandom() {
+	seed_pool(1);
+}
+
+/* A cheaper seedrandom() for frequent use, such as by the listener for
+ * each connection. Only the kernel random source, pid and time are added */
+void reseedrandom() {
+	seed_pool(0);
 }
 
 /* return len bytes of pseudo-random data */
@@ -339,6 +379,64 @@ void genrandom(unsigned char* buf, unsigned int len) {
 	m_burn(hash, sizeof(hash));
 }
 
+#if DROPBEAR_FAST_RANDOM
+/* Discards the fast generator state, it is reseeded from the hashpool
+ * when next used */
+static void fast_reset() {
+	m_burn(fast_key, sizeof(fast_key));
+	m_burn(fast_buf, sizeof(fast_buf));
+	fast_avail = 0;
+	fast_seeded = 0;
+}
+
+/* Refills fast_buf with ChaCha20 keystream. The first FAST_KEY_LEN bytes
+ * of the keystream become the next key, so earlier output can't be
+ * recovered from the state ("fast key erasure"). */
+static void fast_refill() {
+	const unsigned char nonce[8] = {0};
+	chacha_state st;
+
+	if (!fast_seeded) {
+		genrandom(fast_key, sizeof(fast_key));
+		fast_seeded = 1;
+	}
+
+	if (chacha_setup(&st, fast_key, sizeof(fast_key), 20) != CRYPT_OK
+		|| chacha_ivctr64(&st, nonce, sizeof(nonce), 0) != CRYPT_OK
+		|| chacha_keystream(&st, fast_key, sizeof(fast_key)) != CRYPT_OK
+		|| chacha_keystream(&st, fast_buf, sizeof(fast_buf)) != CRYPT_OK) {
+		dropbear_exit("PRNG error");
+	}
+	m_burn(&st, sizeof(st));
+	fast_avail = sizeof(fast_buf);
+}
+#endif /* DROPBEAR_FAST_RANDOM */
+
+/* return len bytes of pseudo-random data, for uses such as packet padding
+ * that are frequent and not long term secrets. Keys should use genrandom() */
+void genrandom_fast(unsigned char* buf, unsigned int len) {
+#if DROPBEAR_FAST_RANDOM
+	unsigned char *src = NULL;
+	unsigned int copylen;
+
+	while (len > 0) {
+		if (fast_avail == 0) {
+			fast_refill();
+		}
+		src = &fast_buf[sizeof(fast_buf) - fast_avail];
+		copylen = MIN(len, fast_avail);
+		memcpy(buf, src, copylen);
+		/* output is erased once used */
+		m_burn(src, copylen);
+		fast_avail -= copylen;
+		len -= copylen;
+		buf += copylen;
+	}
+#else
+	genrandom(buf, len);
+#endif
+}
+
 /* Generates a random mp_int. 
  * max is a *mp_int specifying an upper bound.
  * rand must be an initialised *mp_int for the result.
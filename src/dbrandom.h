@@ -28,7 +28,9 @@
 #include "includes.h"
 
 void seedrandom(void);
+void reseedrandom(void);
 void genrandom(unsigned char* buf, unsigned int len);
+void genrandom_fast(unsigned char* buf, unsigned int len);
 void addrandom(const unsigned char * buf, unsigned int len);
 void gen_random_mpint(const mp_int *max, mp_int *rand);
 
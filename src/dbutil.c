@@ -78,6 +78,8 @@ void (*_dropbear_exit)(int exitcode, const char* format, va_list param) ATTRIB_N
 						= generic_dropbear_exit;
 void (*_dropbear_log)(int priority, const char* format, va_list param)
 						= generic_dropbear_log;
+/* Called by m_close() prior to closing an fd, set by the session poller */
+void (*_dropbear_close_hook)(int fd) = NULL;
 
 #if DEBUG_TRACE
 int debug_trace = 0;
@@ -569,6 +571,10 @@ void m_close(int fd) {
 		return;
 	}
 
+	if (_dropbear_close_hook) {
+		_dropbear_close_hook(fd);
+	}
+
 	do {
 		val = close(fd);
 	} while (val < 0 && errno == EINTR);
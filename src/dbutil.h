@@ -38,6 +38,7 @@ void startsyslog(const char *ident);
 
 extern void (*_dropbear_exit)(int exitcode, const char* format, va_list param) ATTRIB_NORETURN;
 extern void (*_dropbear_log)(int priority, const char* format, va_list param);
+extern void (*_dropbear_close_hook)(int fd);
 
 void dropbear_exit(const char* format, ...) ATTRIB_PRINTF(1,2) ATTRIB_NORETURN;
 
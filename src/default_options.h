@@ -295,8 +295,16 @@ group1 in Dropbear server too */
 /* The first setting is per-IP, to avoid denial of service */
 #define MAX_UNAUTH_PER_IP 5
 
+/* Addresses that share this many leading bits count as a single source
+ * for MAX_UNAUTH_PER_IP. For example 64 for IPv6 would treat each /64
+ * network as one source, since a single host can often use a whole /64 */
+#define UNAUTH_IPV4_PREFIX 32
+#define UNAUTH_IPV6_PREFIX 128
+
 /* And then a global limit to avoid chewing memory if connections
- * come from many IPs */
+ * come from many IPs. The listener's cost per connection doesn't depend
+ * on this, so it can be raised into the thousands provided the open
+ * file limit allows a pipe for each */
 #define MAX_UNAUTH_CLIENTS 30
 
 /* Default maximum number of failed authentication tries (server option) */
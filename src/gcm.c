@@ -75,8 +75,15 @@ static int dropbear_gcm_crypt(unsigned int UNUSED(seq),
 		return err;
 	}
 
-	if ((err = gcm_process(&state->gcm, (unsigned char *) in + 4,
-				len - 4, out + 4, direction)) != CRYPT_OK) {
+	/* gcm_process() takes the plaintext first in either direction */
+	if (direction == LTC_ENCRYPT) {
+		err = gcm_process(&state->gcm, (unsigned char *) in + 4,
+				len - 4, out + 4, direction);
+	} else {
+		err = gcm_process(&state->gcm, out + 4,
+				len - 4, (unsigned char *) in + 4, direction);
+	}
+	if (err != CRYPT_OK) {
 		return err;
 	}
 
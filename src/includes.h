@@ -132,6 +132,14 @@
 #include <sys/prctl.h>
 #endif
 
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifdef HAVE_ENDIAN_H
 #include <endian.h>
 #endif
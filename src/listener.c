@@ -36,7 +36,7 @@ void listeners_initialise() {
 
 }
 
-void set_listener_fds(fd_set * readfds) {
+void set_listener_fds() {
 
 	unsigned int i, j;
 	struct Listener *listener;
@@ -46,14 +46,14 @@ void set_listener_fds(fd_set * readfds) {
 		listener = ses.listeners[i];
 		if (listener != NULL) {
 			for (j = 0; j < listener->nsocks; j++) {
-				FD_SET(listener->socks[j], readfds);
+				dbpoll_set(listener->socks[j], DBPOLL_READ);
 			}
 		}
 	}
 }
 
 
-void handle_listeners(const fd_set * readfds) {
+void handle_listeners() {
 
 	unsigned int i, j;
 	struct Listener *listener;
@@ -65,7 +65,7 @@ void handle_listeners(const fd_set * readfds) {
 		if (listener != NULL) {
 			for (j = 0; j < listener->nsocks; j++) {
 				sock = listener->socks[j];
-				if (FD_ISSET(sock, readfds)) {
+				if (dbpoll_isset(sock, DBPOLL_READ)) {
 					listener->acceptor(listener, sock);
 				}
 			}
@@ -157,7 +157,7 @@ void remove_listener(struct Listener* listener) {
 	}
 
 	for (j = 0; j < listener->nsocks; j++) {
-		close(listener->socks[j]);
+		m_close(listener->socks[j]);
 	}
 	ses.listeners[listener->index] = NULL;
 	m_free(listener);
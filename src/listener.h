@@ -47,8 +47,8 @@ struct Listener {
 };
 
 void listeners_initialise(void);
-void handle_listeners(const fd_set * readfds);
-void set_listener_fds(fd_set * readfds);
+void handle_listeners(void);
+void set_listener_fds(void);
 
 struct Listener* new_listener(const int socks[], unsigned int nsocks,
 		int type, void* typedata, 
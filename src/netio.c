@@ -354,7 +354,7 @@ void remove_connect_pending() {
 }
 
 
-void set_connect_fds(fd_set *writefd) {
+void set_connect_fds() {
 	m_list_elem *iter;
 	iter = ses.conn_pending.first;
 	while (iter) {
@@ -365,7 +365,7 @@ void set_connect_fds(fd_set *writefd) {
 			connect_try_next(c);
 		}
 		if (c->sock >= 0) {
-			FD_SET(c->sock, writefd);
+			dbpoll_set(c->sock, DBPOLL_WRITE);
 		} else {
 			/* Final failure */
 			if (!c->errstring) {
@@ -378,14 +378,14 @@ void set_connect_fds(fd_set *writefd) {
 	}
 }
 
-void handle_connect_fds(const fd_set *writefd) {
+void handle_connect_fds() {
 	m_list_elem *iter;
 	for (iter = ses.conn_pending.first; iter; iter = iter->next) {
 		int val;
 		socklen_t vallen = sizeof(val);
 		struct dropbear_progress_connection *c = iter->item;
 
-		if (c->sock < 0 || !FD_ISSET(c->sock, writefd)) {
+		if (c->sock < 0 || !dbpoll_isset(c->sock, DBPOLL_WRITE)) {
 			continue;
 		}
 
@@ -405,7 +405,9 @@ void handle_connect_fds(const fd_set *writefd) {
 			m_free(c->errstring);
 			c->errstring = m_strdup(strerror(val));
 		} else {
-			/* New connection has been established */
+			/* New connection has been established, the
+			 * callback's user sets up its own interest */
+			dbpoll_unset(c->sock, DBPOLL_WRITE);
 			c->cb(DROPBEAR_SUCCESS, c->sock, c->cb_data, NULL);
 			remove_connect(c, iter);
 			TRACE(("leave handle_connect_fds - success"))
@@ -462,7 +464,7 @@ void packet_queue_consume(struct Queue *queue, ssize_t written) {
 		} else {
 			written -= len;
 			dequeue(queue);
-			buf_free(writebuf);
+			buf_pool_put(&ses.bufpool, writebuf, 0);
 		}
 	}
 }
@@ -593,7 +595,8 @@ int get_sock_port(int sock) {
  * failure, if errstring wasn't NULL, it'll be a newly malloced error
  * string.*/
 int dropbear_listen(const char* address, const char* port,
-		int *socks, unsigned int sockcount, char **errstring, int *maxfd, const char* interface) {
+		int *socks, unsigned int sockcount, char **errstring, int *maxfd,
+		const char* interface, int reuseport) {
 
 	struct addrinfo hints, *res = NULL, *res0 = NULL;
 	int err;
@@ -687,6 +690,19 @@ int dropbear_listen(const char* address, const char* port,
 		/* set to reuse, quick timeout */
 		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void*) &val, sizeof(val));
 
+#ifdef SO_REUSEPORT
+		/* Several sockets bound to the same port, the kernel spreads
+		 * incoming connections between them */
+		if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (void*) &val, sizeof(val)) < 0) {
+			err = errno;
+			close(sock);
+			TRACE(("Failed setsockopt SO_REUSEPORT, %d %s", errno, strerror(errno)))
+			continue;
+		}
+#else
+		(void)reuseport;
+#endif
+
 #ifdef SO_BINDTODEVICE
 		if(interface && setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, interface, strlen(interface)) < 0) {
 			dropbear_log(LOG_WARNING, "Couldn't set SO_BINDTODEVICE");
@@ -37,11 +37,14 @@
 #include "netio.h"
 #include "runopts.h"
 
-static int read_packet_init(void);
+static int read_packet_init(int *may_read);
 static void make_mac(unsigned int seqno, const struct key_context_directional * key_state,
-		buffer * clear_buf, unsigned int clear_len, 
+		const unsigned char *clear, unsigned int clear_len, 
 		unsigned char *output_mac);
-static int checkmac(void);
+static int checkmac(const unsigned char *contents, const unsigned char *mac);
+static void decrypt_packet_from(buffer *src);
+static unsigned int packet_buf_size(unsigned int payload_len);
+static void encrypt_writebuf(buffer * writebuf, unsigned char packet_type);
 
 /* For exact details see http://www.zlib.net/zlib_tech.html
  * 5 bytes per 16kB block, plus 6 bytes for the stream.
@@ -133,7 +136,7 @@ void write_packet() {
 	if (written == len) {
 		/* We've finished with the packet, free it */
 		dequeue(&ses.writequeue);
-		buf_free(writebuf);
+		buf_pool_put(&ses.bufpool, writebuf, 0);
 		writebuf = NULL;
 	} else {
 		/* More packet left to write, leave it in the queue for later */
@@ -144,14 +147,83 @@ void write_packet() {
 	TRACE2(("leave write_packet"))
 }
 
+/* Reads whatever the socket has available into ses.readring. Only called
+ * once the ring's previous contents have all been consumed, so that
+ * packets received before EOF still get processed.
+ * Returns DROPBEAR_FAILURE if nothing was read */
+static int fill_readring() {
+
+	buffer *ring = ses.readring;
+	int len;
+
+	dropbear_assert(ring->pos == ring->len);
+	buf_setpos(ring, 0);
+	buf_setlen(ring, 0);
+
+	len = read(ses.sock_in, buf_getwriteptr(ring, ring->size), ring->size);
+
+	if (len == 0) {
+		ses.remoteclosed();
+		return DROPBEAR_FAILURE;
+	}
+
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN) {
+			TRACE2(("leave fill_readring: EINTR or EAGAIN"))
+			return DROPBEAR_FAILURE;
+		}
+		dropbear_exit("Error reading: %s", strerror(errno));
+	}
+
+	TRACE2(("fill_readring read %d", len))
+	buf_incrlen(ring, len);
+	return DROPBEAR_SUCCESS;
+}
+
+/* Copies up to maxlen bytes of received data to dest, refilling
+ * ses.readring from the socket if it's empty. The socket is read at most
+ * once per read_packet() call, tracked by may_read.
+ * Returns the number of bytes copied */
+static unsigned int read_from_ring(unsigned char *dest, unsigned int maxlen,
+		int *may_read) {
+
+	buffer *ring = ses.readring;
+	unsigned int len;
+
+	if (ring->pos == ring->len) {
+		if (!*may_read) {
+			return 0;
+		}
+		*may_read = 0;
+		if (fill_readring() == DROPBEAR_FAILURE) {
+			return 0;
+		}
+	}
+
+	len = MIN(maxlen, ring->len - ring->pos);
+	memcpy(dest, buf_getptr(ring, len), len);
+	buf_incrpos(ring, len);
+	return len;
+}
+
+/* Whether data that has already been read from the socket is waiting in
+ * ses.readring. read_packet() should then be called even though the socket
+ * mightn't be readable */
+int read_packet_pending() {
+	return ses.readring != NULL && ses.readring->pos < ses.readring->len;
+}
+
 /* Non-blocking function reading available portion of a packet into the
  * ses's buffer, decrypting the length if encrypted, decrypting the
  * full portion if possible */
 void read_packet() {
 
-	int len;
+	unsigned int len;
 	unsigned int maxlen;
 	unsigned char blocksize;
+	int may_read = 1;
+	int direct = 0;
+	unsigned int start = 0;
 
 	TRACE2(("enter read_packet"))
 	blocksize = ses.keys->recv.algo_crypt->blocksize;
@@ -160,9 +232,22 @@ void read_packet() {
 		int ret;
 		/* In the first blocksize of a packet */
 
+		if (ses.readbuf == NULL) {
+			/* A packet that has arrived whole in ses.readring is
+			 * decrypted from there rather than copied first */
+			if (!read_packet_pending()) {
+				may_read = 0;
+				if (fill_readring() == DROPBEAR_FAILURE) {
+					return;
+				}
+			}
+			start = ses.readring->pos;
+			direct = ses.readring->len - start >= blocksize;
+		}
+
 		/* Read the first blocksize of the packet, so we can decrypt it and
 		 * find the length of the whole packet */
-		ret = read_packet_init();
+		ret = read_packet_init(&may_read);
 
 		if (ret == DROPBEAR_FAILURE) {
 			/* didn't read enough to determine the length */
@@ -172,38 +257,32 @@ void read_packet() {
 	}
 
 	/* Attempt to read the remainder of the packet, note that there
-	 * mightn't be any available (EAGAIN) */
+	 * mightn't be any available (EAGAIN). maxlen is 0 when the packet is
+	 * only a single block long and has all been read in read_packet_init().
+	 * Usually means that MAC is disabled */
 	maxlen = ses.readbuf->len - ses.readbuf->pos;
-	if (maxlen == 0) {
-		/* Occurs when the packet is only a single block long and has all
-		 * been read in read_packet_init().  Usually means that MAC is disabled
-		 */
-		len = 0;
-	} else {
-		len = read(ses.sock_in, buf_getptr(ses.readbuf, maxlen), maxlen);
-
+	if (direct && ses.readring->len - ses.readring->pos >= maxlen) {
+		const unsigned int packetlen = ses.readbuf->len;
+		buf_setpos(ses.readring, start);
+		decrypt_packet_from(ses.readring);
+		buf_setpos(ses.readring, start + packetlen);
+		TRACE2(("leave read_packet: direct"))
+		return;
+	}
+	while (maxlen > 0) {
+		len = read_from_ring(buf_getptr(ses.readbuf, maxlen), maxlen, &may_read);
 		if (len == 0) {
-			ses.remoteclosed();
-		}
-
-		if (len < 0) {
-			if (errno == EINTR || errno == EAGAIN) {
-				TRACE2(("leave read_packet: EINTR or EAGAIN"))
-				return;
-			} else {
-				dropbear_exit("Error reading: %s", strerror(errno));
-			}
+			TRACE2(("leave read_packet: incomplete"))
+			return;
 		}
-
 		buf_incrpos(ses.readbuf, len);
+		maxlen -= len;
 	}
 
-	if ((unsigned int)len == maxlen) {
-		/* The whole packet has been read */
-		decrypt_packet();
-		/* The main select() loop process_packet() to
-		 * handle the packet contents... */
-	}
+	/* The whole packet has been read */
+	decrypt_packet();
+	/* The main select() loop process_packet() to
+	 * handle the packet contents... */
 	TRACE2(("leave read_packet"))
 }
 
@@ -211,10 +290,10 @@ void read_packet() {
  * length. Only called during the first BLOCKSIZE of a packet. */
 /* Returns DROPBEAR_SUCCESS if the length is determined, 
  * DROPBEAR_FAILURE otherwise */
-static int read_packet_init() {
+static int read_packet_init(int *may_read) {
 
 	unsigned int maxlen;
-	int slen;
+	unsigned int slen;
 	unsigned int len, plen;
 	unsigned int blocksize;
 	unsigned int macsize;
@@ -225,30 +304,18 @@ static int read_packet_init() {
 
 	if (ses.readbuf == NULL) {
 		/* start of a new packet */
-		ses.readbuf = buf_new(INIT_READBUF);
+		ses.readbuf = buf_pool_get(&ses.bufpool, INIT_READBUF);
 	}
 
-	maxlen = blocksize - ses.readbuf->pos;
-			
-	/* read the rest of the packet if possible */
-	slen = read(ses.sock_in, buf_getwriteptr(ses.readbuf, maxlen),
-			maxlen);
-	if (slen == 0) {
-		ses.remoteclosed();
-	}
-	if (slen < 0) {
-		if (errno == EINTR || errno == EAGAIN) {
-			TRACE2(("leave read_packet_init: EINTR"))
+	while (ses.readbuf->len < blocksize) {
+		maxlen = blocksize - ses.readbuf->len;
+		slen = read_from_ring(buf_getwriteptr(ses.readbuf, maxlen), maxlen,
+				may_read);
+		if (slen == 0) {
+			/* don't have enough bytes to determine length, get next time */
 			return DROPBEAR_FAILURE;
 		}
-		dropbear_exit("Error reading: %s", strerror(errno));
-	}
-
-	buf_incrwritepos(ses.readbuf, slen);
-
-	if ((unsigned int)slen != maxlen) {
-		/* don't have enough bytes to determine length, get next time */
-		return DROPBEAR_FAILURE;
+		buf_incrwritepos(ses.readbuf, slen);
 	}
 
 	/* now we have the first block, need to get packet length, so we decrypt
@@ -287,7 +354,12 @@ static int read_packet_init() {
 	}
 
 	if (len > ses.readbuf->size) {
-		ses.readbuf = buf_resize(ses.readbuf, len);		
+		/* move the first block to a larger buffer */
+		buffer *newbuf = buf_pool_get(&ses.bufpool, len);
+		buf_setpos(ses.readbuf, 0);
+		buf_putbytes(newbuf, buf_getptr(ses.readbuf, blocksize), blocksize);
+		buf_pool_put(&ses.bufpool, ses.readbuf, 1);
+		ses.readbuf = newbuf;
 	}
 	buf_setlen(ses.readbuf, len);
 	buf_setpos(ses.readbuf, blocksize);
@@ -296,11 +368,22 @@ static int read_packet_init() {
 
 /* handle the received packet */
 void decrypt_packet() {
+	/* decrypt it in-place */
+	buf_setpos(ses.readbuf, 0);
+	decrypt_packet_from(ses.readbuf);
+}
+
+/* Decrypts the received packet at the current position of src into
+ * ses.readbuf, which has its first block from read_packet_init() and
+ * its length set. src is either ses.readbuf or ses.readring. */
+static void decrypt_packet_from(buffer *src) {
 
 	unsigned char blocksize;
 	unsigned char macsize;
 	unsigned int padlen;
 	unsigned int len;
+	const unsigned char *in = NULL;
+	unsigned char *out = NULL;
 
 	TRACE2(("enter decrypt_packet"))
 	blocksize = ses.keys->recv.algo_crypt->blocksize;
@@ -308,40 +391,31 @@ void decrypt_packet() {
 
 	ses.kexstate.datarecv += ses.readbuf->len;
 
+	in = buf_getptr(src, ses.readbuf->len);
+	out = ses.readbuf->data;
+
 #if DROPBEAR_AEAD_MODE
 	if (ses.keys->recv.crypt_mode->aead_crypt) {
 		/* first blocksize is not decrypted yet */
-		buf_setpos(ses.readbuf, 0);
-
-		/* decrypt it in-place */
-		len = ses.readbuf->len - macsize - ses.readbuf->pos;
+		len = ses.readbuf->len - macsize;
 		if (ses.keys->recv.crypt_mode->aead_crypt(ses.recvseq,
-					buf_getptr(ses.readbuf, len + macsize),
-					buf_getwriteptr(ses.readbuf, len),
-					len, macsize,
+					in, out, len, macsize,
 					&ses.keys->recv.cipher_state, LTC_DECRYPT) != CRYPT_OK) {
 			dropbear_exit("Error decrypting");
 		}
-		buf_incrpos(ses.readbuf, len);
 	} else
 #endif
 	{
 		/* we've already decrypted the first blocksize in read_packet_init */
-		buf_setpos(ses.readbuf, blocksize);
-
-		/* decrypt it in-place */
-		len = ses.readbuf->len - macsize - ses.readbuf->pos;
+		len = ses.readbuf->len - macsize - blocksize;
 		if (ses.keys->recv.crypt_mode->decrypt(
-					buf_getptr(ses.readbuf, len), 
-					buf_getwriteptr(ses.readbuf, len),
-					len,
+					in + blocksize, out + blocksize, len,
 					&ses.keys->recv.cipher_state) != CRYPT_OK) {
 			dropbear_exit("Error decrypting");
 		}
-		buf_incrpos(ses.readbuf, len);
 
 		/* check the hmac */
-		if (checkmac() != DROPBEAR_SUCCESS) {
+		if (checkmac(out, in + blocksize + len) != DROPBEAR_SUCCESS) {
 			dropbear_exit("Integrity error");
 		}
 
@@ -370,7 +444,7 @@ void decrypt_packet() {
 		ses.payload = buf_decompress(ses.readbuf, len);
 		buf_setpos(ses.payload, 0);
 		ses.payload_beginning = 0;
-		buf_free(ses.readbuf);
+		buf_pool_put(&ses.bufpool, ses.readbuf, 1);
 	} else 
 #endif
 	{
@@ -385,9 +459,9 @@ void decrypt_packet() {
 	TRACE2(("leave decrypt_packet"))
 }
 
-/* Checks the mac at the end of a decrypted readbuf.
+/* Checks the received mac against contents, the decrypted packet.
  * Returns DROPBEAR_SUCCESS or DROPBEAR_FAILURE */
-static int checkmac() {
+static int checkmac(const unsigned char *contents, const unsigned char *mac) {
 
 	unsigned char mac_bytes[MAX_MAC_LEN];
 	unsigned int mac_size, contents_len;
@@ -395,8 +469,7 @@ static int checkmac() {
 	mac_size = ses.keys->recv.algo_mac->hashsize;
 	contents_len = ses.readbuf->len - mac_size;
 
-	buf_setpos(ses.readbuf, 0);
-	make_mac(ses.recvseq, &ses.keys->recv, ses.readbuf, contents_len, mac_bytes);
+	make_mac(ses.recvseq, &ses.keys->recv, contents, contents_len, mac_bytes);
 
 #if DROPBEAR_FUZZ
 	if (fuzz.fuzzing) {
@@ -413,8 +486,7 @@ static int checkmac() {
 #endif
 
 	/* compare the hash */
-	buf_setpos(ses.readbuf, contents_len);
-	if (constant_time_memcmp(mac_bytes, buf_getptr(ses.readbuf, mac_size), mac_size) != 0) {
+	if (constant_time_memcmp(mac_bytes, mac, mac_size) != 0) {
 		return DROPBEAR_FAILURE;
 	} else {
 		return DROPBEAR_SUCCESS;
@@ -518,15 +590,10 @@ void maybe_flush_reply_queue() {
  * to put on the wire */
 void encrypt_packet() {
 
-	unsigned char padlen;
-	unsigned char blocksize, mac_size;
 	buffer * writebuf; /* the packet which will go on the wire. This is 
 	                      encrypted in-place. */
 	unsigned char packet_type;
-	unsigned int len, encrypt_buf_size;
-	unsigned char mac_bytes[MAX_MAC_LEN];
-
-	time_t now;
+	unsigned int encrypt_buf_size;
 	
 	TRACE2(("enter encrypt_packet()"))
 
@@ -544,16 +611,7 @@ void encrypt_packet() {
 		return;
 	}
 		
-	blocksize = ses.keys->trans.algo_crypt->blocksize;
-	mac_size = ses.keys->trans.algo_mac->hashsize;
-
-	/* Encrypted packet len is payload+5. We need to then make sure
-	 * there is enough space for padding or MIN_PACKET_LEN. 
-	 * Add extra 3 since we need at least 4 bytes of padding */
-	encrypt_buf_size = (ses.writepayload->len+4+1) 
-		+ MAX(MIN_PACKET_LEN, blocksize) + 3
-	/* add space for the MAC at the end */
-				+ mac_size
+	encrypt_buf_size = packet_buf_size(ses.writepayload->len)
 #ifndef DISABLE_ZLIB
 	/* some extra in case 'compression' makes it larger */
 				+ ZLIB_COMPRESS_EXPANSION
@@ -562,7 +620,7 @@ void encrypt_packet() {
 	 * packet type */
 				+ 1;
 
-	writebuf = buf_new(encrypt_buf_size);
+	writebuf = buf_pool_get(&ses.bufpool, encrypt_buf_size);
 	buf_setlen(writebuf, PACKET_PAYLOAD_OFF);
 	buf_setpos(writebuf, PACKET_PAYLOAD_OFF);
 
@@ -583,6 +641,78 @@ void encrypt_packet() {
 	buf_setpos(ses.writepayload, 0);
 	buf_setlen(ses.writepayload, 0);
 
+	encrypt_writebuf(writebuf, packet_type);
+
+	TRACE2(("leave encrypt_packet()"))
+}
+
+/* Returns a buffer for building a packet payload of up to payload_len bytes
+ * in place, positioned at the start of the payload. This avoids copying
+ * bulk data out of ses.writepayload. Returns NULL when the payload has to go
+ * through ses.writepayload and encrypt_packet() instead, in which case
+ * the caller should use that. */
+buffer* direct_packet_new(unsigned int payload_len) {
+	buffer * writebuf = NULL;
+
+	if (!ses.dataallowed) {
+		/* might need to wait in the reply queue */
+		return NULL;
+	}
+#ifndef DISABLE_ZLIB
+	if (is_compress_trans()) {
+		return NULL;
+	}
+#endif
+
+	writebuf = buf_pool_get(&ses.bufpool, packet_buf_size(payload_len));
+	buf_setlen(writebuf, PACKET_PAYLOAD_OFF);
+	buf_setpos(writebuf, PACKET_PAYLOAD_OFF);
+	return writebuf;
+}
+
+/* Encrypts and queues a payload built with direct_packet_new().
+ * writebuf is owned by the write queue afterwards. */
+void direct_packet_encrypt(buffer * writebuf) {
+	unsigned char packet_type;
+
+	dropbear_assert(writebuf->len > PACKET_PAYLOAD_OFF);
+	packet_type = writebuf->data[PACKET_PAYLOAD_OFF];
+	TRACE2(("direct_packet_encrypt type is %d", packet_type))
+	encrypt_writebuf(writebuf, packet_type);
+}
+
+/* Size of an outgoing uncompressed packet buffer for payload_len
+ * bytes of payload */
+static unsigned int packet_buf_size(unsigned int payload_len) {
+	unsigned char blocksize, mac_size;
+
+	blocksize = ses.keys->trans.algo_crypt->blocksize;
+	mac_size = ses.keys->trans.algo_mac->hashsize;
+
+	/* Encrypted packet len is payload+5. We need to then make sure
+	 * there is enough space for padding or MIN_PACKET_LEN. 
+	 * Add extra 3 since we need at least 4 bytes of padding */
+	return (payload_len+4+1) 
+		+ MAX(MIN_PACKET_LEN, blocksize) + 3
+	/* add space for the MAC at the end */
+				+ mac_size;
+}
+
+/* Pads, MACs and encrypts writebuf in-place, then queues it for
+ * write_packet(). writebuf holds the payload from PACKET_PAYLOAD_OFF,
+ * with room left for the length header, padding and MAC. */
+static void encrypt_writebuf(buffer * writebuf, unsigned char packet_type) {
+
+	unsigned char padlen;
+	unsigned char blocksize, mac_size;
+	unsigned int len;
+	unsigned char mac_bytes[MAX_MAC_LEN];
+
+	time_t now;
+
+	blocksize = ses.keys->trans.algo_crypt->blocksize;
+	mac_size = ses.keys->trans.algo_mac->hashsize;
+
 	/* length of padding - packet length excluding the packetlength uint32
 	 * field in aead mode must be a multiple of blocksize, with a minimum of
 	 * 4 bytes of padding */
@@ -610,7 +740,7 @@ void encrypt_packet() {
 	/* actual padding */
 	buf_setpos(writebuf, writebuf->len);
 	buf_incrlen(writebuf, padlen);
-	genrandom(buf_getptr(writebuf, padlen), padlen);
+	genrandom_fast(buf_getptr(writebuf, padlen), padlen);
 
 #if DROPBEAR_AEAD_MODE
 	if (ses.keys->trans.crypt_mode->aead_crypt) {
@@ -630,7 +760,7 @@ void encrypt_packet() {
 	} else
 #endif
 	{
-		make_mac(ses.transseq, &ses.keys->trans, writebuf, writebuf->len, mac_bytes);
+		make_mac(ses.transseq, &ses.keys->trans, writebuf->data, writebuf->len, mac_bytes);
 
 		/* do the actual encryption, in-place */
 		buf_setpos(writebuf, 0);
@@ -669,7 +799,6 @@ void encrypt_packet() {
 
 	}
 
-	TRACE2(("leave encrypt_packet()"))
 }
 
 void writebuf_enqueue(buffer * writebuf) {
@@ -683,39 +812,42 @@ void writebuf_enqueue(buffer * writebuf) {
 /* Create the packet mac, and append H(seqno|clearbuf) to the output */
 /* output_mac must have ses.keys->trans.algo_mac->hashsize bytes. */
 static void make_mac(unsigned int seqno, const struct key_context_directional * key_state,
-		buffer * clear_buf, unsigned int clear_len, 
+		const unsigned char *clear, unsigned int clear_len, 
 		unsigned char *output_mac) {
 	unsigned char seqbuf[4];
-	unsigned long bufsize;
-	hmac_state hmac;
+	unsigned char digest[MAXBLOCKSIZE];
+	const struct ltc_hash_descriptor *hash_desc = NULL;
+	hash_state hs;
 
 	if (key_state->algo_mac->hashsize > 0) {
-		/* calculate the mac */
-		if (hmac_init(&hmac, 
-					key_state->hash_index,
-					key_state->mackey,
-					key_state->algo_mac->keysize) != CRYPT_OK) {
-			dropbear_exit("HMAC error");
-		}
+		/* calculate the mac, starting from the precomputed keyed
+		 * states rather than hmac_init() */
+		hash_desc = &hash_descriptor[key_state->hash_index];
+		hs = key_state->mac_inner;
 	
 		/* sequence number */
 		STORE32H(seqno, seqbuf);
-		if (hmac_process(&hmac, seqbuf, 4) != CRYPT_OK) {
+		if (hash_desc->process(&hs, seqbuf, 4) != CRYPT_OK) {
 			dropbear_exit("HMAC error");
 		}
 	
 		/* the actual contents */
-		buf_setpos(clear_buf, 0);
-		if (hmac_process(&hmac, 
-					buf_getptr(clear_buf, clear_len),
-					clear_len) != CRYPT_OK) {
+		if (hash_desc->process(&hs, clear, clear_len) != CRYPT_OK) {
 			dropbear_exit("HMAC error");
 		}
-	
-		bufsize = MAX_MAC_LEN;
-		if (hmac_done(&hmac, output_mac, &bufsize) != CRYPT_OK) {
+		if (hash_desc->done(&hs, digest) != CRYPT_OK) {
 			dropbear_exit("HMAC error");
 		}
+
+		hs = key_state->mac_outer;
+		if (hash_desc->process(&hs, digest, hash_desc->hashsize) != CRYPT_OK
+			|| hash_desc->done(&hs, digest) != CRYPT_OK) {
+			dropbear_exit("HMAC error");
+		}
+
+		memcpy(output_mac, digest, MIN(hash_desc->hashsize, MAX_MAC_LEN));
+		m_burn(digest, sizeof(digest));
+		m_burn(&hs, sizeof(hs));
 	}
 	TRACE2(("leave writemac"))
 }
@@ -32,8 +32,11 @@
 
 void write_packet(void);
 void read_packet(void);
+int read_packet_pending(void);
 void decrypt_packet(void);
 void encrypt_packet(void);
+buffer* direct_packet_new(unsigned int payload_len);
+void direct_packet_encrypt(buffer * writebuf);
 
 void writebuf_enqueue(buffer * writebuf);
 
@@ -0,0 +1,55 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_PREAUTH_H_
+#define DROPBEAR_PREAUTH_H_
+
+#include "includes.h"
+
+/* The listener's tracking of unauthenticated children, used to enforce
+ * MAX_UNAUTH_CLIENTS and MAX_UNAUTH_PER_IP. Each child holds the write end
+ * of a pipe until it authenticates or exits, the listener keeps the read
+ * end. Sources are kept in a hash table keyed on the binary address and
+ * child pipes are indexed by fd, so the cost of an accept or a wakeup
+ * doesn't depend on the number of children. */
+
+/* Sets up tracking with the limits to apply, usually MAX_UNAUTH_CLIENTS
+ * and MAX_UNAUTH_PER_IP. Must be called after seedrandom() */
+void preauth_init(unsigned int max_clients, unsigned int max_per_source);
+/* With -n, the master process sets up counts shared by the acceptors
+ * before starting any, and resets those of an acceptor that exited.
+ * Each acceptor attaches to its own counts before preauth_init(). */
+void preauth_share_init(unsigned int acceptors);
+void preauth_share_reset(unsigned int acceptor);
+void preauth_share_attach(unsigned int acceptor);
+/* Whether the limits allow another unauthenticated connection from addr */
+int preauth_allowed(const struct sockaddr_storage *addr);
+/* Starts tracking childpipe (the read end) as a connection from addr,
+ * and adds dbpoll interest in it */
+void preauth_add(const struct sockaddr_storage *addr, int childpipe);
+/* Closes child pipes that dbpoll_wait() found readable, those children
+ * have authenticated or exited. Only the ready fds are looked at. */
+void preauth_poll_handle(void);
+
+#endif /* DROPBEAR_PREAUTH_H_ */
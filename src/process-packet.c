@@ -159,7 +159,9 @@ void process_packet() {
 
 out:
 	ses.lastpacket = type;
-	buf_free(ses.payload);
+	/* Authentication packets may contain passwords, burn them. Data
+	 * afterwards is left as it always was for buf_free() */
+	buf_pool_put(&ses.bufpool, ses.payload, !ses.authstate.authdone);
 	ses.payload = NULL;
 
 	TRACE2(("leave process_packet"))
@@ -62,6 +62,13 @@ int readhostkey(const char * filename, sign_key * hostkey,
 	enum signkey_type *type);
 void load_all_hostkeys(void);
 
+/* Several listener processes sharing ports, -n */
+#if NON_INETD_MODE && defined(SO_REUSEPORT)
+#define DROPBEAR_SVR_ACCEPTORS 1
+#else
+#define DROPBEAR_SVR_ACCEPTORS 0
+#endif
+
 typedef struct svr_runopts {
 
 	char * bannerfile;
@@ -78,6 +85,15 @@ typedef struct svr_runopts {
 	/* Hidden "-2 childpipe_fd" flag indicates it's re-executing itself,
 	   stores the childpipe preauth file descriptor. Set to -1 otherwise. */
 	int reexec_childpipe;
+	/* Hidden "-3 control_fd" flag starts a spare worker which waits for
+	   a connection from the listener. Set to -1 otherwise. */
+	int reexec_worker;
+	/* Number of spare workers the listener keeps ready, from -S */
+	unsigned int spare_workers;
+	/* Number of listener processes, from -n */
+	unsigned int acceptors;
+	/* Pin each listener process to a CPU */
+	int acceptor_affinity;
 
 	/* Flags indicating whether to use ipv4 and ipv6 */
 	/* not used yet
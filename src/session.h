@@ -38,6 +38,7 @@
 #include "chansession.h"
 #include "dbutil.h"
 #include "netio.h"
+#include "dbpoll.h"
 #if DROPBEAR_PLUGIN
 #include "pubkeyapi.h"
 #endif
@@ -95,6 +96,9 @@ struct key_context_directional {
 #endif
 	} cipher_state;
 	unsigned char mackey[MAX_MAC_LEN];
+	/* HMAC hash states after the padded mackey block, see hmac_precompute() */
+	hash_state mac_inner;
+	hash_state mac_outer;
 	int valid;
 };
 
@@ -135,7 +139,10 @@ struct sshsession {
 	 * by the time any recv_() packet methods are called */
 	char *remoteident;
 
-	int maxfd; /* the maximum file descriptor to check with select() */
+	int maxfd; /* the maximum file descriptor in use, child processes
+				  close everything up to this */
+
+	struct dropbear_poller poller; /* readiness for the main loop, see dbpoll.h */
 
 
 	/* Packet buffers/values etc */
@@ -144,6 +151,9 @@ struct sshsession {
 							 buffer with the packet to send. */
 	struct Queue writequeue; /* A queue of encrypted packets to send */
 	unsigned int writequeue_len; /* Number of bytes pending to send in writequeue */
+	struct buf_pool bufpool; /* Reused packet buffers */
+	buffer *readring; /* Received bytes not yet copied into readbuf, so
+						 several packets can be read with one read() */
 	buffer *readbuf; /* From the wire, decrypted in-place */
 	buffer *payload; /* Post-decompression, the actual SSH packet. 
 						May have extra data at the beginning, will be
@@ -30,14 +30,22 @@
 #include "runopts.h"
 #include "dbrandom.h"
 #include "crypto_desc.h"
+#include "preauth.h"
 
-static size_t listensockets(int *sock, size_t sockcount, int *maxfd);
+static size_t listensockets(int *sock, size_t sockcount, int *maxfd, int reuseport);
 static void sigchld_handler(int dummy);
 static void sigsegv_handler(int);
 static void sigintterm_handler(int fish);
 static void main_inetd(void);
 static void main_noinetd(int argc, char ** argv, const char* multipath);
+#if NON_INETD_MODE
+static void listener_loop(int *listensocks, size_t listensockcount, int acceptor,
+		int execfd, int argc, char ** argv, const char* multipath);
+#endif
 static void commonsetup(void);
+#if DROPBEAR_DO_REEXEC
+static void main_worker(void);
+#endif
 
 #if defined(DBMULTI_dropbear) || !DROPBEAR_MULTI
 #if defined(DBMULTI_dropbear) && DROPBEAR_MULTI
@@ -71,14 +79,18 @@ int main(int argc, char ** argv)
 #endif
 
 #if DROPBEAR_DO_REEXEC
-	if (svr_opts.reexec_childpipe >= 0) {
+	if (svr_opts.reexec_childpipe >= 0 || svr_opts.reexec_worker >= 0) {
 #ifdef PR_SET_NAME
 		/* Fix the "Name:" in /proc/pid/status, otherwise it's
 		a FD number from fexecve.
 		Failure doesn't really matter, it's mostly aesthetic */
 		prctl(PR_SET_NAME, basename(argv[0]), 0, 0);
 #endif
-		main_inetd();
+		if (svr_opts.reexec_worker >= 0) {
+			main_worker();
+		} else {
+			main_inetd();
+		}
 		/* notreached */
 	}
 #endif
@@ -122,23 +134,462 @@ static void main_inetd() {
 }
 #endif /* INETD_MODE */
 
+#if DROPBEAR_DO_REEXEC
+/* Receives a connection passed by the listener's pass_to_spare_worker() */
+static int worker_recv(int ctl, int *sock, int *childpipe) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg = NULL;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	int fds[2];
+	char c;
+	ssize_t len;
+
+	memset(&msg, 0x0, sizeof(msg));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do {
+		len = recvmsg(ctl, &msg, MSG_CMSG_CLOEXEC);
+	} while (len < 0 && errno == EINTR && !ses.exitflag);
+
+	if (len != 1 || (msg.msg_flags & MSG_CTRUNC)) {
+		return DROPBEAR_FAILURE;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+			|| cmsg->cmsg_type != SCM_RIGHTS
+			|| cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		return DROPBEAR_FAILURE;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	*sock = fds[0];
+	*childpipe = fds[1];
+	return DROPBEAR_SUCCESS;
+}
+
+/* A spare worker started by the listener for -S. The startup work is done
+ * before a connection arrives, then it continues the same as a re-executed
+ * child */
+static void main_worker() {
+	const int ctl = svr_opts.reexec_worker;
+	int sock = -1, childpipe = -1;
+	char *host, *port;
+
+	commonsetup();
+
+	seedrandom();
+
+	/* Tell the listener we're ready */
+	if (write(ctl, "r", 1) != 1) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (worker_recv(ctl, &sock, &childpipe) == DROPBEAR_FAILURE) {
+		/* The listener has exited */
+		exit(EXIT_SUCCESS);
+	}
+	m_close(ctl);
+
+	if (sock != STDIN_FILENO) {
+		if (dup2(sock, STDIN_FILENO) < 0) {
+			dropbear_exit("dup2 failed: %s", strerror(errno));
+		}
+		m_close(sock);
+	}
+
+	get_socket_address(STDIN_FILENO, NULL, NULL, &host, &port, 0);
+	dropbear_log(LOG_INFO, "Child connection from %s:%s", host, port);
+	m_free(host);
+	m_free(port);
+
+	svr_session(STDIN_FILENO, childpipe);
+
+	/* notreached */
+}
+#endif /* DROPBEAR_DO_REEXEC */
+
+#if NON_INETD_MODE
+/* Time the listener spends between accept() returning and the child
+ * taking over, in microseconds */
+static struct {
+	unsigned long count;
+	unsigned long total;
+	unsigned long max;
+} accept_latency;
+
+static void accept_latency_add(const struct timespec *start) {
+	struct timespec now;
+	unsigned long us;
+
+	gettime_wrapper(&now);
+	us = (now.tv_sec - start->tv_sec) * 1000000
+		+ (now.tv_nsec - start->tv_nsec) / 1000;
+	accept_latency.count++;
+	accept_latency.total += us;
+	accept_latency.max = MAX(accept_latency.max, us);
+	TRACE(("accept path took %lu us", us))
+}
+
+static void accept_latency_log() {
+	if (accept_latency.count == 0) {
+		return;
+	}
+	dropbear_log(LOG_INFO, "Accepted %lu connections, accept path mean %lu us, max %lu us",
+		accept_latency.count, accept_latency.total / accept_latency.count,
+		accept_latency.max);
+}
+
+#if DROPBEAR_SVR_ACCEPTORS
+/* Set in the master before forking acceptors */
+static struct {
+	sigset_t sigmask; /* the signal mask for acceptors */
+#ifdef HAVE_SCHED_SETAFFINITY
+	int pinned; /* acceptors are pinned with sched_setaffinity() */
+	cpu_set_t cpus; /* the master's CPUs, restored for sessions */
+#endif
+} acceptor_setup;
+
+/* SIGCHLD only needs to interrupt the master's sigsuspend() */
+static void sigchld_master_handler(int UNUSED(unused)) {
+}
+#endif
+
 #if NON_INETD_MODE
+/* Session processes shouldn't be confined to an acceptor's CPU */
+static void unpin_child() {
+#if DROPBEAR_SVR_ACCEPTORS && defined(HAVE_SCHED_SETAFFINITY)
+	if (acceptor_setup.pinned) {
+		if (sched_setaffinity(0, sizeof(acceptor_setup.cpus), &acceptor_setup.cpus) < 0) {
+			TRACE(("sched_setaffinity failed: %s", strerror(errno)))
+		}
+	}
+#endif
+}
+#endif
+
+#if DROPBEAR_DO_REEXEC
+/* Re-executes ourself with "flag fd" added to the arguments. Only returns
+ * on failure. */
+static void reexec_self(int execfd, int argc, char ** argv, const char* multipath,
+		char *flag, int fd) {
+	char **new_argv = m_malloc(sizeof(char*) * (argc+4));
+	char buf[10];
+	int pos0 = 0, new_argc = argc+2;
+
+	/* We need to specially handle "dropbearmulti dropbear". */
+	if (multipath) {
+		new_argv[0] = (char*)multipath;
+		pos0 = 1;
+		new_argc++;
+	}
+
+	memcpy(&new_argv[pos0], argv, sizeof(char*) * argc);
+	new_argv[new_argc-2] = flag;
+	snprintf(buf, sizeof(buf), "%d", fd);
+	new_argv[new_argc-1] = buf;
+	new_argv[new_argc] = NULL;
+
+	fexecve(execfd, new_argv, environ);
+	m_free(new_argv);
+}
+
+/* A pre-started session process, see main_worker() */
+struct spare_worker {
+	int ctl; /* listener's end of the control socket, -1 for an empty slot */
+	int ready; /* the worker has finished starting up */
+};
+
+/* Starts a spare worker in an empty slot. Failure leaves the slot empty
+ * to be tried again later. */
+static void start_spare_worker(struct spare_worker *w, int execfd,
+		int argc, char ** argv, const char* multipath,
+		const int *listensocks, size_t listensockcount) {
+	int ctl[2];
+	pid_t pid;
+	size_t i;
+
+	/* Close-on-exec so that workers don't hold each other's
+	 * control sockets open */
+	if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, ctl) < 0) {
+		TRACE(("socketpair for spare worker failed: %s", strerror(errno)))
+		return;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		dropbear_log(LOG_WARNING, "Error forking: %s", strerror(errno));
+		m_close(ctl[0]);
+		m_close(ctl[1]);
+		return;
+	}
+
+	if (pid == 0) {
+		/* child */
+		if (setsid() < 0) {
+			dropbear_exit("setsid: %s", strerror(errno));
+		}
+		unpin_child();
+		for (i = 0; i < listensockcount; i++) {
+			m_close(listensocks[i]);
+		}
+		if (fcntl(ctl[1], F_SETFD, 0) < 0) {
+			dropbear_exit("fcntl failed: %s", strerror(errno));
+		}
+		reexec_self(execfd, argc, argv, multipath, "-3", ctl[1]);
+		dropbear_exit("fexecve failed: %s", strerror(errno));
+	}
+
+	m_close(ctl[1]);
+	w->ctl = ctl[0];
+	w->ready = 0;
+}
+
+/* Handles the control socket of a spare worker becoming readable, either
+ * it has finished starting up or it has exited. Returns DROPBEAR_FAILURE
+ * if it exited without ever becoming ready. */
+static int spare_worker_event(struct spare_worker *w) {
+	char c;
+	ssize_t len;
+
+	len = read(w->ctl, &c, 1);
+	if (len < 0 && errno == EINTR) {
+		return DROPBEAR_SUCCESS;
+	}
+	if (len == 1 && !w->ready) {
+		w->ready = 1;
+		return DROPBEAR_SUCCESS;
+	}
+
+	m_close(w->ctl);
+	w->ctl = -1;
+	if (!w->ready) {
+		return DROPBEAR_FAILURE;
+	}
+	w->ready = 0;
+	return DROPBEAR_SUCCESS;
+}
+
+/* Passes an accepted connection and its childpipe to a ready spare worker,
+ * which then runs the session. The slot is left empty for a replacement. */
+static int pass_to_spare_worker(struct spare_worker *workers, unsigned int count,
+		int sock, int childpipe) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg = NULL;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	int fds[2];
+	char c = 'c';
+	unsigned int i;
+	ssize_t len;
+
+	for (i = 0; i < count; i++) {
+		struct spare_worker *w = &workers[i];
+		if (w->ctl < 0 || !w->ready) {
+			continue;
+		}
+
+		memset(&msg, 0x0, sizeof(msg));
+		memset(&control, 0x0, sizeof(control));
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		fds[0] = sock;
+		fds[1] = childpipe;
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+		do {
+			len = sendmsg(w->ctl, &msg, 0);
+		} while (len < 0 && errno == EINTR);
+
+		/* The worker has the connection or is gone, either way
+		 * it isn't spare any more */
+		m_close(w->ctl);
+		w->ctl = -1;
+		w->ready = 0;
+
+		if (len == 1) {
+			return DROPBEAR_SUCCESS;
+		}
+		TRACE(("sending to spare worker failed: %s", strerror(errno)))
+	}
+	return DROPBEAR_FAILURE;
+}
+#endif /* DROPBEAR_DO_REEXEC */
+
+#if DROPBEAR_SVR_ACCEPTORS
+/* Forks acceptor a, which runs listener_loop() with its own sockets */
+static pid_t start_acceptor(unsigned int a, int *listensocks, size_t *listensockcount,
+		unsigned int acceptors, int execfd, int argc, char ** argv, const char* multipath) {
+	struct sigaction sa_chld;
+	unsigned int b;
+	size_t i;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		dropbear_log(LOG_WARNING, "Error forking: %s", strerror(errno));
+		return pid;
+	}
+	if (pid > 0) {
+		return pid;
+	}
+
+	/* child */
+	sa_chld.sa_handler = sigchld_handler;
+	sa_chld.sa_flags = SA_NOCLDSTOP;
+	sigemptyset(&sa_chld.sa_mask);
+	if (sigaction(SIGCHLD, &sa_chld, NULL) < 0) {
+		dropbear_exit("signal() error");
+	}
+	sigprocmask(SIG_SETMASK, &acceptor_setup.sigmask, NULL);
+
+	for (b = 0; b < acceptors; b++) {
+		if (b == a) {
+			continue;
+		}
+		for (i = 0; i < listensockcount[b]; i++) {
+			m_close(listensocks[b * MAX_LISTEN_ADDR + i]);
+		}
+	}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (acceptor_setup.pinned) {
+		/* The a'th of the master's CPUs, wrapping around */
+		cpu_set_t cpus;
+		int cpu, n = a % CPU_COUNT(&acceptor_setup.cpus);
+		for (cpu = 0; ; cpu++) {
+			if (CPU_ISSET(cpu, &acceptor_setup.cpus) && n-- == 0) {
+				break;
+			}
+		}
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			dropbear_log(LOG_WARNING, "Couldn't set CPU affinity: %s", strerror(errno));
+		}
+	}
+#endif
+
+	listener_loop(&listensocks[a * MAX_LISTEN_ADDR], listensockcount[a], a,
+		execfd, argc, argv, multipath);
+	/* notreached */
+	return -1;
+}
+
+/* The master process for -n. It keeps the listening sockets open, so that
+ * connections queue while an acceptor is restarted, and restarts acceptors
+ * that exit. */
+static void run_acceptors(int *listensocks, size_t *listensockcount,
+		unsigned int acceptors, int execfd, int argc, char ** argv, const char* multipath) {
+	pid_t pids[DROPBEAR_MAX_ACCEPTORS];
+	time_t started[DROPBEAR_MAX_ACCEPTORS];
+	struct sigaction sa_chld;
+	sigset_t block;
+	unsigned int a;
+	pid_t pid;
+
+	/* Signals are only handled in sigsuspend(), so that one arriving
+	 * just before waiting isn't missed */
+	sigemptyset(&block);
+	sigaddset(&block, SIGCHLD);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigprocmask(SIG_BLOCK, &block, &acceptor_setup.sigmask);
+
+	sa_chld.sa_handler = sigchld_master_handler;
+	sa_chld.sa_flags = SA_NOCLDSTOP;
+	sigemptyset(&sa_chld.sa_mask);
+	if (sigaction(SIGCHLD, &sa_chld, NULL) < 0) {
+		dropbear_exit("signal() error");
+	}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (svr_opts.acceptor_affinity) {
+		if (sched_getaffinity(0, sizeof(acceptor_setup.cpus), &acceptor_setup.cpus) < 0) {
+			dropbear_log(LOG_WARNING, "Couldn't get CPU affinity: %s", strerror(errno));
+		} else {
+			acceptor_setup.pinned = 1;
+		}
+	}
+#else
+	if (svr_opts.acceptor_affinity) {
+		dropbear_log(LOG_WARNING, "CPU affinity isn't supported");
+	}
+#endif
+
+	/* The unauthenticated connection limits apply to all acceptors together */
+	seedrandom();
+	preauth_share_init(acceptors);
+
+	dropbear_log(LOG_INFO, "Starting %u acceptors", acceptors);
+	for (a = 0; a < acceptors; a++) {
+		pids[a] = start_acceptor(a, listensocks, listensockcount, acceptors,
+			execfd, argc, argv, multipath);
+		started[a] = monotonic_now();
+	}
+
+	for (;;) {
+		while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+			for (a = 0; a < acceptors; a++) {
+				if (pids[a] != pid) {
+					continue;
+				}
+				dropbear_log(LOG_WARNING, "Acceptor %u exited, restarting", a);
+				/* Its children are no longer tracked */
+				preauth_share_reset(a);
+				if (monotonic_now() - started[a] < 1) {
+					/* Avoid a fast loop of failures */
+					sleep(1);
+				}
+				pids[a] = start_acceptor(a, listensocks, listensockcount, acceptors,
+					execfd, argc, argv, multipath);
+				started[a] = monotonic_now();
+			}
+		}
+
+		if (ses.exitflag) {
+			for (a = 0; a < acceptors; a++) {
+				if (pids[a] > 0) {
+					kill(pids[a], SIGTERM);
+				}
+			}
+			unlink(svr_opts.pidfile);
+			dropbear_close("Terminated by signal");
+		}
+
+		sigsuspend(&acceptor_setup.sigmask);
+	}
+}
+#endif /* DROPBEAR_SVR_ACCEPTORS */
+
 static void main_noinetd(int argc, char ** argv, const char* multipath) {
-	fd_set fds;
-	unsigned int i, j;
-	int val;
+	unsigned int a;
 	int maxsock = -1;
-	int listensocks[MAX_LISTEN_ADDR];
-	size_t listensockcount = 0;
+	int *listensocks = NULL;
+	size_t listensockcount[DROPBEAR_MAX_ACCEPTORS];
+	unsigned int acceptors = 1;
 	FILE *pidfile = NULL;
 	int execfd = -1;
 
-	int childpipes[MAX_UNAUTH_CLIENTS];
-	char * preauth_addrs[MAX_UNAUTH_CLIENTS];
-
-	int childsock;
-	int childpipe[2];
-
 	(void)argc;
 	(void)argv;
 	(void)multipath;
@@ -148,21 +599,21 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 	   hostkeys. */
 	commonsetup();
 
-	/* sockets to identify pre-authenticated clients */
-	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
-		childpipes[i] = -1;
-	}
-	memset(preauth_addrs, 0x0, sizeof(preauth_addrs));
-
-	/* Set up the listening sockets */
-	listensockcount = listensockets(listensocks, MAX_LISTEN_ADDR, &maxsock);
-	if (listensockcount == 0)
-	{
-		dropbear_exit("No listening ports available.");
-	}
+#if DROPBEAR_SVR_ACCEPTORS
+	acceptors = svr_opts.acceptors;
+#endif
 
-	for (i = 0; i < listensockcount; i++) {
-		FD_SET(listensocks[i], &fds);
+	/* Set up the listening sockets. With several acceptors each has its
+	 * own set bound with SO_REUSEPORT, and the kernel spreads incoming
+	 * connections between them */
+	listensocks = m_malloc(acceptors * MAX_LISTEN_ADDR * sizeof(int));
+	for (a = 0; a < acceptors; a++) {
+		listensockcount[a] = listensockets(&listensocks[a * MAX_LISTEN_ADDR],
+			MAX_LISTEN_ADDR, &maxsock, acceptors > 1);
+		if (listensockcount[a] == 0)
+		{
+			dropbear_exit("No listening ports available.");
+		}
 	}
 
 #if DROPBEAR_DO_REEXEC
@@ -204,28 +655,100 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 		fclose(pidfile);
 	}
 
-	/* incoming connection select loop */
-	for(;;) {
+#if DROPBEAR_SVR_ACCEPTORS
+	if (acceptors > 1) {
+		run_acceptors(listensocks, listensockcount, acceptors,
+			execfd, argc, argv, multipath);
+		/* notreached */
+	}
+#endif
 
-		DROPBEAR_FD_ZERO(&fds);
+	listener_loop(listensocks, listensockcount[0], -1,
+		execfd, argc, argv, multipath);
+	/* notreached */
+}
 
-		/* listening sockets */
-		for (i = 0; i < listensockcount; i++) {
-			FD_SET(listensocks[i], &fds);
+/* Accepts connections and starts sessions. acceptor is the index with -n,
+ * or -1 for the only listener */
+static void listener_loop(int *listensocks, size_t listensockcount, int acceptor,
+		int execfd, int argc, char ** argv, const char* multipath) {
+	unsigned int i, j;
+	int val;
+	int childsock;
+	int childpipe[2];
+	struct timespec accept_time;
+	time_t next_seed = 0;
+
+#if DROPBEAR_DO_REEXEC
+	struct spare_worker spare_workers[MAX_UNAUTH_CLIENTS];
+	unsigned int spare_count = 0;
+
+	/* Spare workers are re-executed ahead of time */
+	spare_count = svr_opts.spare_workers;
+#if DEBUG_NOFORK
+	spare_count = 0;
+#endif
+	if (spare_count > 0 && execfd < 0) {
+		dropbear_log(LOG_WARNING, "Can't re-execute, spare workers disabled");
+		spare_count = 0;
+	}
+	for (i = 0; i < spare_count; i++) {
+		spare_workers[i].ctl = -1;
+		spare_workers[i].ready = 0;
+	}
+#endif
+
+#if DROPBEAR_SVR_ACCEPTORS
+	if (acceptor >= 0) {
+		preauth_share_attach(acceptor);
+	}
+#endif
+
+	/* After daemon(), the poller belongs to this process */
+	dbpoll_init();
+
+	seedrandom();
+	next_seed = monotonic_now() + LISTENER_SEED_INTERVAL;
+
+	/* pipes to identify pre-authenticated clients */
+	preauth_init(MAX_UNAUTH_CLIENTS, MAX_UNAUTH_PER_IP);
+
+	/* listening sockets */
+	for (i = 0; i < listensockcount; i++) {
+		dbpoll_set(listensocks[i], DBPOLL_READ);
+	}
+
+	/* incoming connection loop */
+	for(;;) {
+
+		/* Reading /proc is slow on busy systems, so it is done
+		 * occasionally rather than for every connection */
+		if (monotonic_now() >= next_seed) {
+			seedrandom();
+			next_seed = monotonic_now() + LISTENER_SEED_INTERVAL;
 		}
 
-		/* pre-authentication clients */
-		for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
-			if (childpipes[i] >= 0) {
-				FD_SET(childpipes[i], &fds);
-				maxsock = MAX(maxsock, childpipes[i]);
+#if DROPBEAR_DO_REEXEC
+		/* Replace spare workers used by the last iteration. They start up
+		 * in the background and are used once they report being ready. */
+		for (i = 0; i < spare_count; i++) {
+			if (spare_workers[i].ctl < 0) {
+				start_spare_worker(&spare_workers[i], execfd, argc, argv,
+					multipath, listensocks, listensockcount);
+			}
+			if (spare_workers[i].ctl >= 0) {
+				dbpoll_set(spare_workers[i].ctl, DBPOLL_READ);
 			}
 		}
+#endif
 
-		val = select(maxsock+1, &fds, NULL, NULL, NULL);
+		val = dbpoll_wait(-1);
 
 		if (ses.exitflag) {
-			unlink(svr_opts.pidfile);
+			if (acceptor < 0) {
+				unlink(svr_opts.pidfile);
+			}
+			accept_latency_log();
 			dropbear_close("Terminated by signal");
 		}
 
@@ -243,25 +766,31 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 
 		/* close fds which have been authed or closed - svr-auth.c handles
 		 * closing the auth sockets on success */
-		for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
-			if (childpipes[i] >= 0 && FD_ISSET(childpipes[i], &fds)) {
-				m_close(childpipes[i]);
-				childpipes[i] = -1;
-				m_free(preauth_addrs[i]);
+		preauth_poll_handle();
+
+#if DROPBEAR_DO_REEXEC
+		for (i = 0; i < spare_count; i++) {
+			if (spare_workers[i].ctl >= 0
+					&& dbpoll_isset(spare_workers[i].ctl, DBPOLL_READ)
+					&& spare_worker_event(&spare_workers[i]) == DROPBEAR_FAILURE) {
+				/* Avoid a loop of failing forks */
+				dropbear_log(LOG_WARNING, "Spare worker failed to start, disabling spare workers");
+				for (j = 0; j < spare_count; j++) {
+					m_close(spare_workers[j].ctl);
+				}
+				spare_count = 0;
 			}
 		}
+#endif
 
 		/* handle each socket which has something to say */
 		for (i = 0; i < listensockcount; i++) {
-			size_t num_unauthed_for_addr = 0;
-			size_t num_unauthed_total = 0;
 			char *remote_host = NULL, *remote_port = NULL;
 			pid_t fork_ret = 0;
-			size_t conn_idx = 0;
 			struct sockaddr_storage remoteaddr;
 			socklen_t remoteaddrlen;
 
-			if (!FD_ISSET(listensocks[i], &fds)) 
+			if (!dbpoll_isset(listensocks[i], DBPOLL_READ)) 
 				continue;
 
 			remoteaddrlen = sizeof(remoteaddr);
@@ -272,60 +801,59 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 				/* accept failed */
 				continue;
 			}
+			gettime_wrapper(&accept_time);
 
 			/* Limit the number of unauthenticated connections per IP */
-			getaddrstring(&remoteaddr, &remote_host, NULL, 0);
-
-			num_unauthed_for_addr = 0;
-			num_unauthed_total = 0;
-			for (j = 0; j < MAX_UNAUTH_CLIENTS; j++) {
-				if (childpipes[j] >= 0) {
-					num_unauthed_total++;
-					if (strcmp(remote_host, preauth_addrs[j]) == 0) {
-						num_unauthed_for_addr++;
-					}
-				} else {
-					/* a free slot */
-					conn_idx = j;
-				}
-			}
-
-			if (num_unauthed_total >= MAX_UNAUTH_CLIENTS
-					|| num_unauthed_for_addr >= MAX_UNAUTH_PER_IP) {
+			if (!preauth_allowed(&remoteaddr)) {
 				goto out;
 			}
 
-			seedrandom();
-
 			if (pipe(childpipe) < 0) {
 				TRACE(("error creating child pipe"))
 				goto out;
 			}
+			/* Other children don't need the listener's end */
+			if (fcntl(childpipe[0], F_SETFD, FD_CLOEXEC) < 0) {
+				TRACE(("cloexec for childpipe failed: %s", strerror(errno)))
+			}
+
+#if DROPBEAR_DO_REEXEC
+			if (pass_to_spare_worker(spare_workers, spare_count,
+					childsock, childpipe[1]) == DROPBEAR_SUCCESS) {
+				/* The worker takes the place of a forked child */
+				fork_ret = 1;
+			} else
+#endif
+			{
+				reseedrandom();
 
 #if DEBUG_NOFORK
-			fork_ret = 0;
+				fork_ret = 0;
 #else
-			fork_ret = fork();
+				fork_ret = fork();
 #endif
-			if (fork_ret < 0) {
-				dropbear_log(LOG_WARNING, "Error forking: %s", strerror(errno));
-				goto out;
-			}
+				if (fork_ret < 0) {
+					dropbear_log(LOG_WARNING, "Error forking: %s", strerror(errno));
+					m_close(childpipe[0]);
+					m_close(childpipe[1]);
+					goto out;
+				}
 
-			addrandom((void*)&fork_ret, sizeof(fork_ret));
+				addrandom((void*)&fork_ret, sizeof(fork_ret));
+			}
 
 			if (fork_ret > 0) {
 
 				/* parent */
-				childpipes[conn_idx] = childpipe[0];
+				preauth_add(&remoteaddr, childpipe[0]);
 				m_close(childpipe[1]);
-				preauth_addrs[conn_idx] = remote_host;
-				remote_host = NULL;
+
+				accept_latency_add(&accept_time);
 
 			} else {
 
 				/* child */
-				getaddrstring(&remoteaddr, NULL, &remote_port, 0);
+				getaddrstring(&remoteaddr, &remote_host, &remote_port, 0);
 				dropbear_log(LOG_INFO, "Child connection from %s:%s", remote_host, remote_port);
 				m_free(remote_host);
 				m_free(remote_port);
@@ -334,6 +862,7 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 				if (setsid() < 0) {
 					dropbear_exit("setsid: %s", strerror(errno));
 				}
+				unpin_child();
 #endif
 
 				/* make sure we close sockets */
@@ -345,42 +874,27 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 
 				if (execfd >= 0) {
 #if DROPBEAR_DO_REEXEC
-					/* Add "-2 childpipe[1]" to the args and re-execute ourself. */
-					char **new_argv = m_malloc(sizeof(char*) * (argc+4));
-					char buf[10];
-					int pos0 = 0, new_argc = argc+2;
-
-					/* We need to specially handle "dropbearmulti dropbear". */
-					if (multipath) {
-						new_argv[0] = (char*)multipath;
-						pos0 = 1;
-						new_argc++;
-					}
-
-					memcpy(&new_argv[pos0], argv, sizeof(char*) * argc);
-					new_argv[new_argc-2] = "-2";
-					snprintf(buf, sizeof(buf), "%d", childpipe[1]);
-					new_argv[new_argc-1] = buf;
-					new_argv[new_argc] = NULL;
-
 					if ((dup2(childsock, STDIN_FILENO) < 0)) {
 						dropbear_exit("dup2 failed: %s", strerror(errno));
 					}
 					if (fcntl(childsock, F_SETFD, FD_CLOEXEC) < 0) {
 						TRACE(("cloexec for childsock %d failed: %s", childsock, strerror(errno)))
 					}
-					/* Re-execute ourself */
-					fexecve(execfd, new_argv, environ);
+					/* Re-execute ourself with "-2 childpipe[1]" added */
+					reexec_self(execfd, argc, argv, multipath, "-2", childpipe[1]);
 					/* Not reached on success */
 
 					/* Fall back on plain fork otherwise.
 					 * To be removed in future once re-exec has been well tested */
 					dropbear_log(LOG_WARNING, "fexecve failed, disabling re-exec: %s", strerror(errno));
 					m_close(STDIN_FILENO);
-					m_free(new_argv);
 #endif /* DROPBEAR_DO_REEXEC */
 				}
 
+				/* Not re-executed, gather the slow seed sources here
+				 * rather than in the listener */
+				seedrandom();
+
 				/* start the session */
 				svr_session(childsock, childpipe[1]);
 				/* don't return */
@@ -390,9 +904,6 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 out:
 			/* This section is important for the parent too */
 			m_close(childsock);
-			if (remote_host) {
-				m_free(remote_host);
-			}
 		}
 	} /* for(;;) loop */
 
@@ -473,7 +984,7 @@ static void commonsetup() {
 }
 
 /* Set up listening sockets for all the requested ports */
-static size_t listensockets(int *socks, size_t sockcount, int *maxfd) {
+static size_t listensockets(int *socks, size_t sockcount, int *maxfd, int reuseport) {
 
 	unsigned int i, n;
 	char* errstring = NULL;
@@ -488,7 +999,7 @@ static size_t listensockets(int *socks, size_t sockcount, int *maxfd) {
 
 		nsock = dropbear_listen(svr_opts.addresses[i], svr_opts.ports[i], &socks[sockpos], 
 				sockcount - sockpos,
-				&errstring, maxfd, svr_opts.interface);
+				&errstring, maxfd, svr_opts.interface, reuseport);
 
 		if (nsock < 0) {
 			dropbear_log(LOG_WARNING, "Failed listening on '%s': %s", 
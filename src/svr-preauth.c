@@ -0,0 +1,426 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "dbrandom.h"
+#include "dbpoll.h"
+#include "runopts.h"
+#include "preauth.h"
+
+#if DROPBEAR_SVR_ACCEPTORS
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+/* A family tag followed by the masked address */
+#define PREAUTH_KEY_LEN 17
+#define PREAUTH_KEY_INET 4
+#define PREAUTH_KEY_INET6 6
+#define PREAUTH_KEY_VSOCK 7
+
+struct preauth_source {
+	unsigned char key[PREAUTH_KEY_LEN];
+	unsigned int count; /* unauthenticated children */
+	struct preauth_source *next; /* hash chain */
+};
+
+struct preauth_child {
+	int childpipe;
+	struct preauth_source *source;
+};
+
+static struct {
+	/* Sources with at least one child. There can't be more than
+	 * max_clients so the table doesn't need to grow */
+	struct preauth_source **buckets;
+	unsigned int bucketmask;
+	/* Random so that a remote host can't choose colliding addresses */
+	unsigned char hashkey[16];
+
+	struct preauth_child *children;
+	unsigned int nchildren;
+	/* Index into children of each child pipe, indexed by fd, -1 when
+	 * the fd isn't a child pipe */
+	int *childfds;
+	unsigned int childfdsize;
+
+	unsigned int max_clients;
+	unsigned int max_per_source;
+} preauth;
+
+#if DROPBEAR_SVR_ACCEPTORS
+/* With -n the limits apply to the sum over all acceptors. Each acceptor
+ * publishes its counts in a row of memory shared with the others, and
+ * only writes its own row. A row is the number of children followed by
+ * the number of children for each bucket of source hashes. Sources that
+ * share a bucket in another acceptor's row are counted together, which
+ * can only make the limit stricter. Acceptors that accept at the same
+ * moment can each miss the other's new child, so the limits can briefly
+ * be exceeded by up to the number of acceptors less one. */
+static struct {
+	volatile unsigned int *rows;
+	unsigned int rowlen;
+	unsigned int nrows;
+	unsigned int bucketmask;
+	volatile unsigned int *own; /* NULL without -n */
+} preauth_shared;
+#endif
+
+void preauth_init(unsigned int max_clients, unsigned int max_per_source) {
+	unsigned int nbuckets = 16;
+
+	preauth.max_clients = max_clients;
+	preauth.max_per_source = max_per_source;
+
+	while (nbuckets < max_clients) {
+		nbuckets *= 2;
+	}
+	preauth.buckets = m_malloc(nbuckets * sizeof(*preauth.buckets));
+	preauth.bucketmask = nbuckets - 1;
+#if DROPBEAR_SVR_ACCEPTORS
+	if (preauth_shared.own) {
+		/* The key is shared, set by preauth_share_init() */
+	} else
+#endif
+	{
+		genrandom(preauth.hashkey, sizeof(preauth.hashkey));
+	}
+
+	preauth.children = m_malloc(max_clients * sizeof(*preauth.children));
+	preauth.nchildren = 0;
+	preauth.childfds = NULL;
+	preauth.childfdsize = 0;
+}
+
+static void childfds_grow(int fd) {
+	unsigned int newsize = MAX(64, preauth.childfdsize);
+	unsigned int i;
+
+	while (newsize <= (unsigned int)fd) {
+		newsize *= 2;
+	}
+	preauth.childfds = m_realloc(preauth.childfds,
+		newsize * sizeof(*preauth.childfds));
+	for (i = preauth.childfdsize; i < newsize; i++) {
+		preauth.childfds[i] = -1;
+	}
+	preauth.childfdsize = newsize;
+}
+
+/* Keeps the leading prefix bits of an address */
+static void mask_addr(unsigned char *addr, unsigned int len, unsigned int prefix) {
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if (prefix >= 8) {
+			prefix -= 8;
+		} else {
+			addr[i] &= (0xff00 >> prefix) & 0xff;
+			prefix = 0;
+		}
+	}
+}
+
+/* Addresses that count as the same source get the same key, see
+ * UNAUTH_IPV4_PREFIX and UNAUTH_IPV6_PREFIX */
+static void source_key(const struct sockaddr_storage *addr,
+		unsigned char key[PREAUTH_KEY_LEN]) {
+
+	memset(key, 0x0, PREAUTH_KEY_LEN);
+
+	if (addr->ss_family == AF_INET) {
+		const struct sockaddr_in *sin = (const struct sockaddr_in*)addr;
+		key[0] = PREAUTH_KEY_INET;
+		memcpy(&key[1], &sin->sin_addr, 4);
+		mask_addr(&key[1], 4, UNAUTH_IPV4_PREFIX);
+	}
+#ifdef AF_INET6
+	else if (addr->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)addr;
+		if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+			/* The same as a plain IPv4 connection */
+			key[0] = PREAUTH_KEY_INET;
+			memcpy(&key[1], &sin6->sin6_addr.s6_addr[12], 4);
+			mask_addr(&key[1], 4, UNAUTH_IPV4_PREFIX);
+		} else {
+			key[0] = PREAUTH_KEY_INET6;
+			memcpy(&key[1], &sin6->sin6_addr, 16);
+			mask_addr(&key[1], 16, UNAUTH_IPV6_PREFIX);
+		}
+	}
+#endif
+#ifdef HAVE_LINUX_VM_SOCKETS_H
+	else if (addr->ss_family == AF_VSOCK) {
+		const struct sockaddr_vm *svm = (const struct sockaddr_vm*)addr;
+		key[0] = PREAUTH_KEY_VSOCK;
+		memcpy(&key[1], &svm->svm_cid, sizeof(svm->svm_cid));
+	}
+#endif
+	/* Anything else counts as a single source */
+}
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND do { \
+	v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+	v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+} while (0)
+
+/* SipHash-2-4. Every output bit depends on the whole of k, so without
+ * knowing it a remote host can't choose addresses that share a bucket. */
+static uint64_t siphash24(const unsigned char k[16],
+		const unsigned char *in, unsigned int len) {
+	uint64_t k0, k1, m, v0, v1, v2, v3;
+	unsigned int i;
+
+	LOAD64L(k0, k);
+	LOAD64L(k1, k + 8);
+	v0 = k0 ^ 0x736f6d6570736575ULL;
+	v1 = k1 ^ 0x646f72616e646f6dULL;
+	v2 = k0 ^ 0x6c7967656e657261ULL;
+	v3 = k1 ^ 0x7465646279746573ULL;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		LOAD64L(m, in + i);
+		v3 ^= m;
+		SIP_ROUND;
+		SIP_ROUND;
+		v0 ^= m;
+	}
+
+	/* The last bytes, with the length in the top byte */
+	m = (uint64_t)len << 56;
+	for (; i < len; i++) {
+		m |= (uint64_t)in[i] << (8 * (i % 8));
+	}
+	v3 ^= m;
+	SIP_ROUND;
+	SIP_ROUND;
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIP_ROUND;
+	SIP_ROUND;
+	SIP_ROUND;
+	SIP_ROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint32_t source_hash(const unsigned char key[PREAUTH_KEY_LEN]) {
+	return (uint32_t)siphash24(preauth.hashkey, key, PREAUTH_KEY_LEN);
+}
+
+static struct preauth_source** source_bucket(const unsigned char key[PREAUTH_KEY_LEN]) {
+	return &preauth.buckets[source_hash(key) & preauth.bucketmask];
+}
+
+#if DROPBEAR_SVR_ACCEPTORS
+void preauth_share_init(unsigned int acceptors) {
+	unsigned int nbuckets = 64;
+	size_t len;
+	void *rows = NULL;
+
+	/* Plenty of buckets, so that sources rarely share one */
+	while (nbuckets < 8 * MAX_UNAUTH_CLIENTS) {
+		nbuckets *= 2;
+	}
+	preauth_shared.rowlen = 1 + nbuckets;
+	preauth_shared.nrows = acceptors;
+	preauth_shared.bucketmask = nbuckets - 1;
+	len = (size_t)acceptors * preauth_shared.rowlen * sizeof(unsigned int);
+	rows = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (rows == MAP_FAILED) {
+		dropbear_exit("Failed to share limits: %s", strerror(errno));
+	}
+	memset(rows, 0x0, len);
+	preauth_shared.rows = rows;
+
+	genrandom(preauth.hashkey, sizeof(preauth.hashkey));
+}
+
+void preauth_share_reset(unsigned int acceptor) {
+	unsigned int i;
+	volatile unsigned int *row = &preauth_shared.rows[acceptor * preauth_shared.rowlen];
+
+	for (i = 0; i < preauth_shared.rowlen; i++) {
+		row[i] = 0;
+	}
+}
+
+void preauth_share_attach(unsigned int acceptor) {
+	preauth_shared.own = &preauth_shared.rows[acceptor * preauth_shared.rowlen];
+}
+
+/* Adds change to the published counts for a source */
+static void shared_update(const unsigned char key[PREAUTH_KEY_LEN], int change) {
+	volatile unsigned int *own = preauth_shared.own;
+
+	if (own) {
+		own[0] += change;
+		own[1 + (source_hash(key) & preauth_shared.bucketmask)] += change;
+	}
+}
+
+/* Children of the other acceptors, in total and for the bucket of key */
+static void shared_others(const unsigned char key[PREAUTH_KEY_LEN],
+		unsigned int *total, unsigned int *source) {
+	unsigned int b = 1 + (source_hash(key) & preauth_shared.bucketmask);
+	unsigned int a;
+
+	*total = 0;
+	*source = 0;
+	for (a = 0; a < preauth_shared.nrows; a++) {
+		volatile unsigned int *row = &preauth_shared.rows[a * preauth_shared.rowlen];
+		if (row == preauth_shared.own) {
+			continue;
+		}
+		*total += row[0];
+		*source += row[b];
+	}
+}
+#endif
+
+static struct preauth_source* source_find(struct preauth_source **bucket,
+		const unsigned char key[PREAUTH_KEY_LEN]) {
+	struct preauth_source *s = NULL;
+
+	for (s = *bucket; s; s = s->next) {
+		if (memcmp(s->key, key, PREAUTH_KEY_LEN) == 0) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+int preauth_allowed(const struct sockaddr_storage *addr) {
+	unsigned char key[PREAUTH_KEY_LEN];
+	struct preauth_source *s = NULL;
+	unsigned int total = 0, source = 0;
+
+	if (preauth.nchildren >= preauth.max_clients) {
+		return 0;
+	}
+
+	source_key(addr, key);
+#if DROPBEAR_SVR_ACCEPTORS
+	if (preauth_shared.own) {
+		shared_others(key, &total, &source);
+	}
+#endif
+	if (preauth.nchildren + total >= preauth.max_clients) {
+		return 0;
+	}
+	s = source_find(source_bucket(key), key);
+	if (s) {
+		source += s->count;
+	}
+	return source < preauth.max_per_source;
+}
+
+void preauth_add(const struct sockaddr_storage *addr, int childpipe) {
+	unsigned char key[PREAUTH_KEY_LEN];
+	struct preauth_source **bucket = NULL;
+	struct preauth_source *s = NULL;
+	struct preauth_child *c = NULL;
+
+	dropbear_assert(preauth.nchildren < preauth.max_clients);
+
+	source_key(addr, key);
+	bucket = source_bucket(key);
+	s = source_find(bucket, key);
+	if (s == NULL) {
+		s = m_malloc(sizeof(*s));
+		memcpy(s->key, key, PREAUTH_KEY_LEN);
+		s->next = *bucket;
+		*bucket = s;
+	}
+	s->count++;
+#if DROPBEAR_SVR_ACCEPTORS
+	shared_update(key, 1);
+#endif
+
+	if ((unsigned int)childpipe >= preauth.childfdsize) {
+		childfds_grow(childpipe);
+	}
+	preauth.childfds[childpipe] = preauth.nchildren;
+	c = &preauth.children[preauth.nchildren];
+	c->childpipe = childpipe;
+	c->source = s;
+	preauth.nchildren++;
+
+	/* Interest lasts until the pipe is closed in preauth_poll_handle() */
+	dbpoll_set(childpipe, DBPOLL_READ);
+}
+
+static void source_release(struct preauth_source *s) {
+	struct preauth_source **p = NULL;
+
+	s->count--;
+#if DROPBEAR_SVR_ACCEPTORS
+	shared_update(s->key, -1);
+#endif
+	if (s->count > 0) {
+		return;
+	}
+
+	for (p = source_bucket(s->key); *p != s; p = &(*p)->next) {
+		/* nothing */
+	}
+	*p = s->next;
+	m_free(s);
+}
+
+void preauth_poll_handle() {
+	const int *ready = NULL;
+	unsigned int nready, i;
+
+	nready = dbpoll_ready(&ready);
+	for (i = 0; i < nready; i++) {
+		int fd = ready[i];
+		struct preauth_child *c = NULL;
+		int idx;
+
+		if ((unsigned int)fd >= preauth.childfdsize
+				|| preauth.childfds[fd] < 0
+				|| !dbpoll_isset(fd, DBPOLL_READ)) {
+			continue;
+		}
+
+		idx = preauth.childfds[fd];
+		c = &preauth.children[idx];
+		m_close(c->childpipe);
+		source_release(c->source);
+		preauth.childfds[fd] = -1;
+		/* Replace with the last entry */
+		preauth.nchildren--;
+		if ((unsigned int)idx != preauth.nchildren) {
+			*c = preauth.children[preauth.nchildren];
+			preauth.childfds[c->childpipe] = idx;
+		}
+	}
+}
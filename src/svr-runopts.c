@@ -108,6 +108,15 @@ static void printhelp(const char * progname) {
 #endif
 #if INETD_MODE
 					"-i		Start for inetd\n"
+#endif
+#if DROPBEAR_DO_REEXEC && NON_INETD_MODE
+					"-S <spare_workers>\n"
+					"		Keep processes ready to start sessions (default 0, max %d)\n"
+#endif
+#if DROPBEAR_SVR_ACCEPTORS
+					"-n <acceptors>[,affinity]\n"
+					"		Accept connections with this many processes (max %d),\n"
+					"		optionally each pinned to a CPU\n"
 #endif
 					"-W <receive_window_buffer> (default %d, larger may be faster, max 10MB)\n"
 					"-K <keepalive>  (0 is never, default %d, in seconds)\n"
@@ -136,6 +145,12 @@ static void printhelp(const char * progname) {
 #endif
 					MAX_AUTH_TRIES,
 					DROPBEAR_MAX_PORTS, DROPBEAR_DEFPORT, DROPBEAR_PIDFILE,
+#if DROPBEAR_DO_REEXEC && NON_INETD_MODE
+					MAX_UNAUTH_CLIENTS,
+#endif
+#if DROPBEAR_SVR_ACCEPTORS
+					DROPBEAR_MAX_ACCEPTORS,
+#endif
 					DEFAULT_RECV_WINDOW, DEFAULT_KEEPALIVE, DEFAULT_IDLE_TIMEOUT);
 }
 
@@ -149,6 +164,9 @@ void svr_getopts(int argc, char ** argv) {
 	char* idle_timeout_arg = NULL;
 	char* maxauthtries_arg = NULL;
 	char* reexec_fd_arg = NULL;
+	char* worker_fd_arg = NULL;
+	char* spare_workers_arg = NULL;
+	char* acceptors_arg = NULL;
 	char* keyfile = NULL;
 	char c;
 #if DROPBEAR_PLUGIN
@@ -189,6 +207,10 @@ void svr_getopts(int argc, char ** argv) {
 #endif
 	svr_opts.pass_on_env = 0;
 	svr_opts.reexec_childpipe = -1;
+	svr_opts.reexec_worker = -1;
+	svr_opts.spare_workers = 0;
+	svr_opts.acceptors = 1;
+	svr_opts.acceptor_affinity = 0;
 
 #ifndef DISABLE_ZLIB
 	opts.allow_compress = 1;
@@ -272,6 +294,17 @@ void svr_getopts(int argc, char ** argv) {
 				case '2':
 					next = &reexec_fd_arg;
 					break;
+				case '3':
+					next = &worker_fd_arg;
+					break;
+				case 'S':
+					next = &spare_workers_arg;
+					break;
+#endif
+#if DROPBEAR_SVR_ACCEPTORS
+				case 'n':
+					next = &acceptors_arg;
+					break;
 #endif
 				case 'p':
 					nextisport = 1;
@@ -452,6 +485,40 @@ void svr_getopts(int argc, char ** argv) {
 		}
 	}
 
+	if (worker_fd_arg) {
+		if (m_str_to_uint(worker_fd_arg, &svr_opts.reexec_worker) == DROPBEAR_FAILURE
+			|| svr_opts.reexec_worker < 0) {
+			dropbear_exit("Bad -3");
+		}
+	}
+
+	if (spare_workers_arg) {
+		if (m_str_to_uint(spare_workers_arg, &svr_opts.spare_workers) == DROPBEAR_FAILURE
+			|| svr_opts.spare_workers > MAX_UNAUTH_CLIENTS) {
+			dropbear_exit("Bad spare workers '%s'", spare_workers_arg);
+		}
+	}
+
+	if (acceptors_arg) {
+		/* argv is left intact, it's passed on when re-executing */
+		char *count = m_strdup(acceptors_arg);
+		char *affinity = strchr(count, ',');
+		if (affinity) {
+			*affinity = '\0';
+			affinity++;
+			if (strcmp(affinity, "affinity") != 0) {
+				dropbear_exit("Bad -n option '%s'", affinity);
+			}
+			svr_opts.acceptor_affinity = 1;
+		}
+		if (m_str_to_uint(count, &svr_opts.acceptors) == DROPBEAR_FAILURE
+			|| svr_opts.acceptors == 0
+			|| svr_opts.acceptors > DROPBEAR_MAX_ACCEPTORS) {
+			dropbear_exit("Bad acceptors '%s'", acceptors_arg);
+		}
+		m_free(count);
+	}
+
 	if (svr_opts.multiauthmethod && svr_opts.noauthpass) {
 		dropbear_exit("-t and -s are incompatible");
 	}
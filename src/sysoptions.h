@@ -34,6 +34,11 @@
 #ifndef AUTH_TIMEOUT
 #define AUTH_TIMEOUT 300 /* we choose 5 minutes */
 #endif
+/* The listener only does a full seedrandom() at this interval, each
+ * connection gets a cheaper reseedrandom() */
+#ifndef LISTENER_SEED_INTERVAL
+#define LISTENER_SEED_INTERVAL 60 /* seconds */
+#endif
 
 #define DROPBEAR_SVR_PUBKEY_OPTIONS_BUILT ((DROPBEAR_SVR_PUBKEY_AUTH) && (DROPBEAR_SVR_PUBKEY_OPTIONS))
 
@@ -92,6 +97,8 @@
 /* Each port might have at least a v4 and a v6 address */
 #define MAX_LISTEN_ADDR (DROPBEAR_MAX_PORTS*3)
 
+#define DROPBEAR_MAX_ACCEPTORS 64 /* max listener processes with -n */
+
 #define _PATH_TTY "/dev/tty"
 
 #define _PATH_CP "/bin/cp"
@@ -130,6 +137,11 @@
    for the crypt time which will expose which usernames exist */
 #define DROPBEAR_MAX_PASSWORD_LEN 100
 
+/* ChaCha20 based generator for packet padding, see genrandom_fast() */
+#ifndef DROPBEAR_FAST_RANDOM
+#define DROPBEAR_FAST_RANDOM 1
+#endif
+
 #define SHA1_HASH_SIZE 20
 #define SHA256_HASH_SIZE 32
 #define MAX_HASH_SIZE 64 /* sha512 */
@@ -242,6 +254,12 @@
 
 #define RECV_MAX_PACKET_LEN (MAX(35000, ((RECV_MAX_PAYLOAD_LEN)+100)))
 
+/* Input from the socket is read into a buffer this size, so that
+ * several packets can be received with a single read() */
+#define RECV_RING_LEN (2*RECV_MAX_PACKET_LEN)
+/* Upper limit on packets handled per main loop iteration */
+#define RECV_MAX_PACKETS_PER_LOOP 16
+
 /* for channel code */
 #define TRANS_MAX_WINDOW 500000000 /* 500MB is sufficient, stopping overflow */
 #define TRANS_MAX_WIN_INCR 500000000 /* overflow prevention */
@@ -425,6 +443,16 @@
 
 #define DROPBEAR_TRACKING_MALLOC (DROPBEAR_FUZZ)
 
+/* The session and listener loops use epoll() where available, otherwise
+ * select(). Fuzzing relies on wrapping select() so always uses that. */
+#ifndef DROPBEAR_EPOLL
+#if defined(HAVE_SYS_EPOLL_H) && !DROPBEAR_FUZZ
+#define DROPBEAR_EPOLL 1
+#else
+#define DROPBEAR_EPOLL 0
+#endif
+#endif
+
 /* Used to work around Memory Sanitizer false positives */
 #if defined(__has_feature)
 #  if __has_feature(memory_sanitizer)
@@ -4,6 +4,7 @@ def pytest_addoption(parser):
     parser.addoption("--dropbear", type=str, default="../dropbear")
     parser.addoption("--dropbearconvert", type=str, default="../dropbearconvert")
     parser.addoption("--dropbearkey", type=str, default="../dropbearkey")
+    parser.addoption("--dbbench", type=str, default="../dbbench")
     parser.addoption("--hostkey", type=str, help="required unless --remote")
     parser.addoption("--remote", type=str, help="remote host")
     parser.addoption("--user", type=str, help="optional username")
@@ -0,0 +1,160 @@
+from test_dropbear import *
+import socket
+
+# Tests for the listener: pre-started session workers, several acceptor
+# processes and the limits on unauthenticated connections
+
+@pytest.fixture
+def listener(request):
+	""" Runs dropbear with the extra arguments given as the parameter """
+	opt = request.config.option
+	if opt.remote:
+		pytest.skip("needs a local dropbear")
+
+	args = opt.dropbear.split() + [
+		"-p", LOCALADDR + ":" + opt.port,
+		"-r", opt.hostkey,
+		"-F", "-E",
+		] + list(request.param)
+	print("subprocess args: ", args)
+
+	p = subprocess.Popen(args, stderr=subprocess.PIPE, text=True)
+	for l in p.stderr:
+		if "Not backgrounding" in l:
+			break
+	assert p.poll() is None
+	# keep reading the log so that dropbear never blocks on it
+	p.log = []
+	t = threading.Thread(target=lambda: p.log.extend(p.stderr))
+	t.start()
+	yield p
+	p.terminate()
+	p.wait()
+	t.join()
+	print("Terminated dropbear. Output:")
+	for l in p.log:
+		print(l.rstrip())
+
+def children(pid):
+	""" Returns a dict of pid to command line for the children of pid """
+	c = {}
+	for d in os.listdir("/proc"):
+		try:
+			with open(f"/proc/{d}/stat") as f:
+				ppid = int(f.read().rsplit(")", 1)[1].split()[1])
+			if ppid == pid:
+				with open(f"/proc/{d}/cmdline") as f:
+					c[int(d)] = f.read().split("\0")
+		except (ValueError, OSError, IndexError):
+			pass
+	return c
+
+def spare_workers(pid, count, timeout=5):
+	""" Waits until there are count spare workers and no sessions, which
+	also run as re-executed workers, and returns their pids """
+	end = time.time() + timeout
+	while True:
+		w = [c for c, cmd in children(pid).items() if "-3" in cmd]
+		if len(w) == count or time.time() > end:
+			return w
+		time.sleep(0.05)
+
+@pytest.mark.parametrize("listener", [["-S", "2"]], indirect=True)
+def test_spare_worker_used(request, listener):
+	""" Sessions run in workers that were started before they connected """
+	for i in range(5):
+		spare = spare_workers(listener.pid, 2)
+		assert len(spare) == 2
+		# the shell's parent is the session process
+		r = dbclient(request, "echo $PPID", capture_output=True, text=True)
+		r.check_returncode()
+		assert int(r.stdout.split()[-1]) in spare
+
+@pytest.mark.parametrize("listener", [["-S", "2"]], indirect=True)
+def test_spare_worker_bulk(request, listener):
+	dat = os.urandom(16_000_000)
+	r = dbclient(request, "cat", input=dat, capture_output=True, timeout=60)
+	r.check_returncode()
+	assert r.stdout == dat
+
+def unauth_connect(request, src):
+	""" Connects from address src without authenticating. Returns the
+	socket, or None if the listener closed it without a banner """
+	opt = request.config.option
+	s = socket.socket()
+	s.bind((src, 0))
+	s.connect((LOCALADDR, int(opt.port)))
+	s.settimeout(5)
+	if not s.recv(100).startswith(b"SSH-2.0-"):
+		s.close()
+		return None
+	return s
+
+@pytest.mark.parametrize("listener", [[], ["-n", "2"]], indirect=True)
+def test_unauth_per_source(request, listener):
+	""" Connections over MAX_UNAUTH_PER_IP from one source are refused """
+	held = [unauth_connect(request, "127.0.7.1") for i in range(5)]
+	assert None not in held
+	for i in range(3):
+		assert unauth_connect(request, "127.0.7.1") is None
+	# with the default UNAUTH_IPV4_PREFIX of 32 the neighbouring addresses
+	# are different sources. With -n one of them can share a bucket of the
+	# shared table with 127.0.7.1 and be counted with it, so try a few.
+	for i in range(2, 5):
+		other = unauth_connect(request, f"127.0.7.{i}")
+		if other:
+			break
+	assert other is not None
+
+	# a slot frees once a child exits
+	held.pop().close()
+	end = time.time() + 5
+	while True:
+		s = unauth_connect(request, "127.0.7.1")
+		if s or time.time() > end:
+			break
+		time.sleep(0.05)
+	assert s is not None
+	for s in held + [s, other]:
+		s.close()
+
+@pytest.mark.parametrize("listener", [[], ["-S", "2"], ["-n", "3"]], indirect=True)
+def test_unauth_total(request, listener):
+	""" No more than MAX_UNAUTH_CLIENTS unauthenticated connections in
+	total, whichever sources they come from """
+	# one connection per source, so that sources sharing a bucket of the
+	# -n table never reach MAX_UNAUTH_PER_IP
+	held = [unauth_connect(request, f"127.0.8.{i + 1}") for i in range(30)]
+	assert None not in held
+	assert unauth_connect(request, "127.0.8.100") is None
+	for s in held:
+		s.close()
+
+def acceptors(pid, count, timeout=5):
+	""" Waits until there are count acceptor processes, returns their pids """
+	end = time.time() + timeout
+	while True:
+		a = list(children(pid))
+		if len(a) == count or time.time() > end:
+			return a
+		time.sleep(0.05)
+
+@pytest.mark.parametrize("listener", [["-n", "2"]], indirect=True)
+def test_acceptors_share(request, listener):
+	""" Connections are spread over the acceptors, which each run the
+	sessions they accepted """
+	acc = acceptors(listener.pid, 2)
+	assert len(acc) == 2
+	held = [unauth_connect(request, f"127.0.9.{i + 1}") for i in range(20)]
+	assert None not in held
+	assert all(children(a) for a in acc)
+	for s in held:
+		s.close()
+
+@pytest.mark.parametrize("listener", [["-n", "2"], ["-n", "2", "-S", "2"]], indirect=True)
+def test_acceptors_bulk(request, listener):
+	dats = [os.urandom(8_000_000 + i) for i in range(3)]
+	for dat in dats:
+		r = dbclient(request, "cat", input=dat, capture_output=True, timeout=60)
+		r.check_returncode()
+		assert r.stdout == dat
@@ -0,0 +1,202 @@
+from test_dropbear import *
+import hashlib
+import random
+import socket
+
+# Tests for the session loop and the packet transport, with enough data
+# and channels that many fds and packets are in flight at once
+
+class EchoTcp(socketserver.ThreadingMixIn, socketserver.TCPServer):
+	""" Echoes everything back on any number of connections """
+
+	allow_reuse_address = True
+	daemon_threads = True
+
+	def __init__(self, port):
+		super().__init__(('localhost', port), self.Handler)
+
+	class Handler(socketserver.BaseRequestHandler):
+		def handle(self):
+			while True:
+				d = self.request.recv(65536)
+				if not d:
+					break
+				self.request.sendall(d)
+
+	def __enter__(self):
+		self.server_thread = threading.Thread(target=self.serve_forever)
+		self.server_thread.daemon = True
+		self.server_thread.start()
+		return self
+
+	def __exit__(self, *exc_stuff):
+		self.shutdown()
+		self.server_close()
+		self.server_thread.join()
+
+def connect_retry(port, timeout=5):
+	""" Connects to a forwarded port, waiting for the listener to appear """
+	end = time.time() + timeout
+	while True:
+		try:
+			return socket.create_connection(("localhost", port))
+		except ConnectionRefusedError:
+			if time.time() > end:
+				raise
+			time.sleep(0.05)
+
+def echo_roundtrip(sock, dat):
+	""" Sends dat while reading the echo, returns what came back """
+	out = []
+	def reader():
+		out.append(readall_socket(sock))
+	t = threading.Thread(target=reader)
+	t.start()
+	sock.sendall(dat)
+	sock.shutdown(socket.SHUT_WR)
+	t.join(30)
+	return out[0]
+
+@pytest.mark.parametrize("size", [1_000_000, 16_000_000])
+def test_bulk_roundtrip(request, dropbear, size):
+	dat = os.urandom(size)
+	r = dbclient(request, "cat", input=dat, capture_output=True, timeout=60)
+	r.check_returncode()
+	assert r.stdout == dat
+
+def test_bulk_upload(request, dropbear):
+	dat = os.urandom(16_000_000)
+	r = dbclient(request, "sha256sum", input=dat, capture_output=True,
+		timeout=60)
+	r.check_returncode()
+	assert r.stdout.split()[0].decode() == hashlib.sha256(dat).hexdigest()
+
+# Covers each of the receive paths in packet.c
+@pytest.mark.parametrize("cipher,mac", [
+	("aes128-ctr", "hmac-sha2-256"),
+	("aes256-ctr", None),
+	("chacha20-poly1305@openssh.com", None),
+	])
+def test_small_writes(request, dropbear, cipher, mac):
+	""" Many small packets in flight, so that one read from the socket
+	holds several of them """
+	args = ["-c", cipher] + (["-m", mac] if mac else [])
+	p = dbclient(request, *args, "cat", background=True,
+		stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+	chunks = [os.urandom(random.randint(1, 300)) for i in range(20000)]
+	out = []
+	t = threading.Thread(target=lambda: out.append(p.stdout.read()))
+	t.start()
+	for c in chunks:
+		p.stdin.write(c)
+		p.stdin.flush()
+	p.stdin.close()
+	t.join(60)
+	assert p.wait(10) == 0
+	assert out[0] == b"".join(chunks)
+
+def test_parallel_sessions(request, dropbear):
+	# fewer than the default unauthenticated connections per source
+	dats = [os.urandom(500_000 + i * 1000) for i in range(4)]
+	procs = [dbclient(request, "cat", background=True,
+		stdin=subprocess.PIPE, stdout=subprocess.PIPE) for d in dats]
+	outs = [None] * len(procs)
+	def run(i):
+		outs[i] = procs[i].communicate(dats[i], timeout=60)[0]
+	threads = [threading.Thread(target=run, args=(i,)) for i in range(len(procs))]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+	for p, d, o in zip(procs, dats, outs):
+		assert p.returncode == 0
+		assert o == d
+
+def test_mixed_channels(request, dropbear):
+	""" Packets of every size on several channels at once, so buffers of
+	each size go back and forth through the session's pool """
+	opt = request.config.option
+	if opt.remote:
+		pytest.xfail("don't know address for remote")
+
+	with EchoTcp(3348):
+		dat = os.urandom(4_000_000)
+		r = dbclient(request, "-L", "7792:localhost:3348", "sleep 1; cat",
+			background=True, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+		try:
+			out = []
+			t = threading.Thread(target=lambda: out.append(r.communicate(dat, timeout=60)[0]))
+			t.start()
+			results = {}
+			def fwd(chunk):
+				c = connect_retry(7792)
+				d = b"".join(os.urandom(chunk) for i in range(2_000_000 // chunk))
+				results[chunk] = (echo_roundtrip(c, d) == d)
+				c.close()
+			fwds = [threading.Thread(target=fwd, args=(chunk,))
+				for chunk in (1, 100, 5000, 40000)]
+			for f in fwds:
+				f.start()
+			for f in fwds:
+				f.join(60)
+			t.join(60)
+			assert all(results.values()) and len(results) == 4
+			assert out[0] == dat
+		finally:
+			r.kill()
+			r.wait()
+
+def test_bufpool_reuse(request):
+	""" Buffers for a bulk transfer nearly all come from the pool """
+	opt = request.config.option
+	r = subprocess.run([opt.dbbench, "bufpool"], capture_output=True, text=True)
+	r.check_returncode()
+	for l in r.stdout.splitlines():
+		if l.startswith("packet buffers reused"):
+			reused, total = (int(w) for w in l.split()[3::2])
+			break
+	else:
+		assert False, r.stdout
+	# only the first packet's buffers are allocated
+	assert total - reused <= 3
+
+def test_many_idle_forwards(request, dropbear):
+	""" One busy forwarded connection among many idle ones """
+	opt = request.config.option
+	if opt.remote:
+		pytest.xfail("don't know address for remote")
+
+	with EchoTcp(3346):
+		r = dbclient(request, "-L", "7790:localhost:3346", "sleep 30",
+			background=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+		try:
+			idle = [connect_retry(7790) for i in range(50)]
+			for i in range(3):
+				c = connect_retry(7790)
+				dat = os.urandom(2_000_000)
+				assert echo_roundtrip(c, dat) == dat
+				c.close()
+			# the idle ones still work
+			for c in idle[::10]:
+				assert echo_roundtrip(c, b"ping") == b"ping"
+			for c in idle:
+				c.close()
+		finally:
+			r.terminate()
+			r.wait()
+
+def test_background_forward(request, dropbear):
+	""" dbclient -f forks after authenticating, the child must keep
+	serving the forward """
+	opt = request.config.option
+	if opt.remote:
+		pytest.xfail("don't know address for remote")
+
+	with EchoTcp(3347):
+		r = dbclient(request, "-f", "-L", "7791:localhost:3347", "sleep 5",
+			stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+		r.check_returncode()
+		c = connect_retry(7791)
+		dat = os.urandom(1_000_000)
+		assert echo_roundtrip(c, dat) == dat
+		c.close()